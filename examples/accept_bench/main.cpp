@@ -0,0 +1,223 @@
+// Accept benchmark: opens N loopback connections against an afsm::io::server
+// and reports accepts/sec and resident memory per established session.
+//
+//   accept_bench [connections=100000] [shards=hardware threads]
+//
+// Server and clients share the process, so 2 * N descriptors are needed; the
+// soft RLIMIT_NOFILE is raised as far as the hard limit allows.
+
+// ours
+#include <bench.hpp>
+#include <log.hpp>
+
+#include <afsm/io/acceptor.hpp>
+#include <afsm/state.hpp>
+#include <afsm/state_machine.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// system
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+class peer_closed {};
+class session_stopped {};
+
+// a session doing nothing but waiting for its peer to hang up
+class idle : public afsm::state<peer_closed, session_stopped> {
+public:
+    idle(asio::io_service& io, asio::ip::tcp::socket& sock) :
+        state(io),
+        sock(sock)
+    {}
+
+    virtual void on_enter() override {
+        sock.async_read_some(asio::buffer(&byte, 1), track([this](const std::error_code& ec, std::size_t) {
+            if (ec == asio::error::operation_aborted) {
+                return complete<session_stopped>();
+            }
+            ec ? complete<peer_closed>() : on_enter();
+        }));
+    }
+
+    virtual void cancel() override {
+        complete<session_stopped>();
+        sock.cancel();
+    }
+private:
+    asio::ip::tcp::socket&  sock;
+    char                    byte;
+};
+
+struct closed {
+    template<typename ...Args>
+    closed(Args&& ...) {}
+};
+
+struct session_context {
+    session_context(asio::io_service& io, asio::ip::tcp::socket&& sock) :
+        io(io),
+        sock(std::move(sock))
+    {}
+
+    asio::io_service&       io;
+    asio::ip::tcp::socket   sock;
+};
+
+namespace afsm {
+template<typename Event>
+struct state_factory<idle, Event, session_context> {
+    auto operator()(const Event&, session_context& ctx) const {
+        return std::make_tuple(std::ref(ctx.io), std::ref(ctx.sock));
+    }
+};
+
+template<typename Event>
+struct result_factory<Event, session_context> {
+    bool operator()(const Event&, session_context&) const {
+        return true;
+    }
+};
+} // namespace afsm
+
+struct session_traits {
+    using start_state = idle;
+    using end_state = closed;
+    using context = session_context;
+    using result = bool;
+    using transitions = afsm::transitions<
+        afsm::transition<idle, peer_closed, closed>,
+        afsm::transition<idle, session_stopped, closed>
+    >;
+};
+
+using session = afsm::state_machine<session_traits>;
+using server = afsm::io::server<session>;
+
+// connects `count` sockets from 127.x.y.z source addresses, so the ephemeral
+// port range of a single source address does not limit the benchmark
+static void connect_clients(std::size_t first, std::size_t count, unsigned short port, std::vector<int>& fds) {
+    for (auto i = first; i < first + count; ++i) {
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            continue;
+        }
+
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+
+        sockaddr_in src{};
+        src.sin_family = AF_INET;
+        src.sin_addr.s_addr = htonl(0x7f000000u | (1u + static_cast<unsigned>(i / 16384)) << 8 | 2u);
+        ::bind(fd, reinterpret_cast<sockaddr*>(&src), sizeof(src));
+
+        sockaddr_in dst{};
+        dst.sin_family = AF_INET;
+        dst.sin_port = htons(port);
+        dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&dst), sizeof(dst)) != 0) {
+            ::close(fd);
+            continue;
+        }
+        fds[i] = fd;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    std::size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    std::size_t nshards = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : std::max(1u, std::thread::hardware_concurrency());
+    const unsigned short port = 5556;
+
+    auto limit = raise_fd_limit(2 * n + 64);
+    if (limit < 2 * n + 64) {
+        n = (limit - 64) / 2;
+        log("RLIMIT_NOFILE is {}, benchmarking {} connections", limit, n);
+    }
+
+    asio::io_service io;
+    std::vector<std::unique_ptr<asio::io_service>> shards;
+    std::vector<asio::io_service*> shard_ptrs;
+    std::vector<asio::io_service::work> work;
+    for (std::size_t i = 0; i < nshards; ++i) {
+        shards.push_back(std::make_unique<asio::io_service>());
+        shard_ptrs.push_back(shards.back().get());
+        work.emplace_back(*shards.back());
+    }
+
+    afsm::io::session_pool<session> pool(n, shard_ptrs);
+    afsm::io::acceptor_options opts;
+    opts.concurrent_accepts = 64;
+
+    server srv(io);
+    srv.async_wait([&](const std::error_code& ec) {
+        if (ec) {
+            log("server failed: {}", ec.message());
+        }
+    }, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), port), pool, opts);
+
+    std::vector<std::thread> threads;
+    for (auto& s : shards) {
+        threads.emplace_back([&s] { s->run(); });
+    }
+    threads.emplace_back([&io] { io.run(); });
+
+    auto rss_before = rss_bytes();
+    auto started = std::chrono::steady_clock::now();
+
+    std::vector<int> fds(n, -1);
+    std::vector<std::thread> clients;
+    std::size_t nclients = std::max<std::size_t>(4, nshards);
+    for (std::size_t c = 0; c < nclients; ++c) {
+        auto first = n * c / nclients;
+        auto last = n * (c + 1) / nclients;
+        clients.emplace_back(connect_clients, first, last - first, port, std::ref(fds));
+    }
+    for (auto& t : clients) {
+        t.join();
+    }
+
+    auto connected = static_cast<std::size_t>(std::count_if(fds.begin(), fds.end(), [](int fd) { return fd >= 0; }));
+    // a connection the server never got (e.g. out of descriptors) must not hang the run
+    auto deadline = std::chrono::milliseconds(60000);
+    if (!wait_until([&] { return pool.active() >= connected; }, deadline)) {
+        log("only {} of {} connections became sessions within {}s", pool.active(), connected, deadline.count() / 1000);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+    auto rss_after = rss_bytes();
+
+    log("{} sessions on {} shards in {:.3f}s: {:.0f} accepts/sec", connected, nshards, elapsed.count(), connected / elapsed.count());
+    if (connected) {
+        log("rss {:.1f} MiB -> {:.1f} MiB, {:.0f} bytes per session", rss_before / 1048576.0, rss_after / 1048576.0,
+            (static_cast<double>(rss_after) - rss_before) / connected);
+    }
+
+    // hanging up ends every session, the pool drains back to empty
+    for (auto fd : fds) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    if (!wait_until([&] { return pool.active() == 0; }, deadline)) {
+        log("{} sessions still running after {}s, cancelling them", pool.active(), deadline.count() / 1000);
+        pool.cancel_all();
+        wait_until([&] { return pool.active() == 0; }, deadline);
+    }
+
+    asio::post(io, [&] { srv.cancel(); });
+    work.clear();
+    for (auto& t : threads) {
+        t.join();
+    }
+    return 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <thread>
+
+// system
+#include <sys/resource.h>
+#include <unistd.h>
+
+// resident set size of this process
+inline std::size_t rss_bytes() {
+    long pages = 0, resident = 0;
+    if (auto f = std::fopen("/proc/self/statm", "r")) {
+        if (std::fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        std::fclose(f);
+    }
+    return static_cast<std::size_t>(resident) * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// raises the soft descriptor limit towards `wanted`, returns the new limit
+inline std::size_t raise_fd_limit(std::size_t wanted) {
+    rlimit lim{};
+    getrlimit(RLIMIT_NOFILE, &lim);
+    if (lim.rlim_cur < wanted) {
+        lim.rlim_cur = lim.rlim_max == RLIM_INFINITY ? wanted : std::min<rlim_t>(wanted, lim.rlim_max);
+        setrlimit(RLIMIT_NOFILE, &lim);
+        getrlimit(RLIMIT_NOFILE, &lim);
+    }
+    return lim.rlim_cur;
+}
+
+// polls `p` every millisecond; false if `timeout` passed first
+template<typename Predicate>
+bool wait_until(Predicate&& p, std::chrono::milliseconds timeout = std::chrono::milliseconds::max()) {
+    auto deadline = timeout == std::chrono::milliseconds::max()
+        ? std::chrono::steady_clock::time_point::max()
+        : std::chrono::steady_clock::now() + timeout;
+    while (!p()) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
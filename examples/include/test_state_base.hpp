@@ -9,13 +9,21 @@
 // thirdparty
 #include <asio.hpp>
 
+// std
+#include <atomic>
+#include <cstdint>
+
+// states of the examples entered so far, a measure of transitions
+inline std::atomic<std::uint64_t> states_entered{0};
+
 template<typename Host, typename ...Events>
 class test_state_base : public afsm::state<Events...> {
 public:
     test_state_base(asio::io_service& io) :
         afsm::state<Events...>(io) 
     {
-        log("entering {}", afsm::util::type_name<Host>());
+        states_entered.fetch_add(1, std::memory_order_relaxed);
+        log("entering {}", afsm::util::lazy_type_name_of<Host>());
     }
     virtual ~test_state_base() = default;
 };
@@ -0,0 +1,300 @@
+// Short-lived request machines against a local echo server, once taking
+// warm connections from an afsm::io::connection_pool and once dialing a new
+// connection per request.
+//
+//   pooled_requests [requests=20000] [concurrency=16]
+
+// ours
+#include <log.hpp>
+
+#include <afsm/io/connection_pool.hpp>
+#include <afsm/state.hpp>
+#include <afsm/state_machine.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <system_error>
+
+using afsm::io::lease;
+using afsm::io::leased;
+using afsm::io::lease_failed;
+using afsm::io::lease_stopped;
+using afsm::io::leasing;
+
+class answered {};
+class request_failed {
+public:
+    request_failed() = default;
+    request_failed(const std::error_code& ec) noexcept : ec(ec) {}
+    std::error_code ec;
+};
+
+class dialed_once {
+public:
+    dialed_once(asio::ip::tcp::socket& sock) noexcept : sock(sock) {}
+    std::reference_wrapper<asio::ip::tcp::socket> sock;
+
+    operator asio::ip::tcp::socket&() const {
+        return sock.get();
+    }
+};
+
+inline asio::ip::tcp::socket& socket_of(lease& l) { return l.socket(); }
+inline asio::ip::tcp::socket& socket_of(asio::ip::tcp::socket& s) { return s; }
+
+// pooled connections go back to the pool, the others are closed
+inline void done_with(lease& l) { l.recycle(); }
+inline void done_with(asio::ip::tcp::socket&) {}
+
+class dialing_once : public afsm::state<dialed_once, request_failed> {
+public:
+    dialing_once(asio::io_service& io, const asio::ip::tcp::endpoint& ep) :
+        state(io),
+        sock(io),
+        ep(ep)
+    {}
+
+    virtual void on_enter() override {
+        sock.async_connect(ep, track([this](const std::error_code& ec) {
+            ec ? complete<request_failed>(ec) : complete<dialed_once>(sock);
+        }));
+    }
+
+    virtual void cancel() override {
+        complete<request_failed>();
+        sock.cancel();
+    }
+private:
+    asio::ip::tcp::socket   sock;
+    asio::ip::tcp::endpoint ep;
+};
+
+// one request/response exchange on a connection
+template<typename Connection>
+class exchanging : public afsm::state<answered, request_failed> {
+public:
+    exchanging(asio::io_service& io, Connection& conn) :
+        state(io),
+        conn(std::move(conn))
+    {}
+
+    virtual void on_enter() override {
+        asio::async_write(socket_of(conn), asio::buffer("ping\n", 5), track([this](const std::error_code& ec, std::size_t) {
+            if (ec) {
+                return complete<request_failed>(ec);
+            }
+
+            asio::async_read(socket_of(conn), asio::buffer(reply), track([this](const std::error_code& ec, std::size_t) {
+                if (ec) {
+                    return complete<request_failed>(ec);
+                }
+
+                complete<answered>();
+                done_with(conn);
+            }));
+        }));
+    }
+
+    virtual void cancel() override {
+        // a recycled lease has no socket any more
+        if (!active()) {
+            return;
+        }
+
+        complete<request_failed>();
+        socket_of(conn).cancel();
+    }
+private:
+    Connection              conn;
+    std::array<char, 5>     reply;
+};
+
+struct finished {
+    template<typename ...Args>
+    finished(Args&& ...) {}
+};
+
+struct pooled_context {
+    pooled_context(asio::io_service& io, afsm::io::connection_pool& pool) : io(io), pool(pool) {}
+    asio::io_service&               io;
+    afsm::io::connection_pool&      pool;
+};
+
+struct cold_context {
+    cold_context(asio::io_service& io, const asio::ip::tcp::endpoint& ep) : io(io), ep(ep) {}
+    asio::io_service&               io;
+    asio::ip::tcp::endpoint         ep;
+};
+
+namespace afsm {
+template<typename Event>
+struct state_factory<leasing, Event, pooled_context> {
+    auto operator()(const Event&, pooled_context& ctx) const {
+        return std::make_tuple(std::ref(ctx.io), std::ref(ctx.pool));
+    }
+};
+
+template<typename Event>
+struct state_factory<dialing_once, Event, cold_context> {
+    auto operator()(const Event&, cold_context& ctx) const {
+        return std::make_tuple(std::ref(ctx.io), ctx.ep);
+    }
+};
+
+template<typename Event>
+struct result_factory<Event, pooled_context> {
+    bool operator()(const Event&, pooled_context&) const {
+        return std::is_same_v<Event, answered>;
+    }
+};
+
+template<typename Event>
+struct result_factory<Event, cold_context> {
+    bool operator()(const Event&, cold_context&) const {
+        return std::is_same_v<Event, answered>;
+    }
+};
+} // namespace afsm
+
+struct pooled_traits {
+    using start_state = leasing;
+    using end_state = finished;
+    using context = pooled_context;
+    using result = bool;
+    using transitions = afsm::transitions<
+        afsm::transition<leasing, leased, exchanging<lease>>,
+        afsm::transition<leasing, lease_failed, finished>,
+        afsm::transition<leasing, lease_stopped, finished>,
+
+        afsm::transition<exchanging<lease>, answered, finished>,
+        afsm::transition<exchanging<lease>, request_failed, finished>
+    >;
+};
+
+struct cold_traits {
+    using start_state = dialing_once;
+    using end_state = finished;
+    using context = cold_context;
+    using result = bool;
+    using transitions = afsm::transitions<
+        afsm::transition<dialing_once, dialed_once, exchanging<asio::ip::tcp::socket>>,
+        afsm::transition<dialing_once, request_failed, finished>,
+
+        afsm::transition<exchanging<asio::ip::tcp::socket>, answered, finished>,
+        afsm::transition<exchanging<asio::ip::tcp::socket>, request_failed, finished>
+    >;
+};
+
+using pooled_request = afsm::state_machine<pooled_traits>;
+using cold_request = afsm::state_machine<cold_traits>;
+
+// echoes everything back
+class echo_server {
+public:
+    echo_server(asio::io_service& io) :
+        acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0))
+    {
+        accept();
+    }
+
+    asio::ip::tcp::endpoint endpoint() const {
+        return acceptor.local_endpoint();
+    }
+
+    void stop() {
+        acceptor.close();
+    }
+private:
+    struct connection : std::enable_shared_from_this<connection> {
+        connection(asio::ip::tcp::socket sock) : sock(std::move(sock)) {}
+
+        void read() {
+            sock.async_read_some(asio::buffer(buf), [self = shared_from_this()](const std::error_code& ec, std::size_t n) {
+                if (!ec) {
+                    asio::async_write(self->sock, asio::buffer(self->buf, n), [self](const std::error_code& ec, std::size_t) {
+                        if (!ec) {
+                            self->read();
+                        }
+                    });
+                }
+            });
+        }
+
+        asio::ip::tcp::socket   sock;
+        char                    buf[512];
+    };
+
+    void accept() {
+        acceptor.async_accept([this](const std::error_code& ec, asio::ip::tcp::socket sock) {
+            if (!ec) {
+                std::make_shared<connection>(std::move(sock))->read();
+                accept();
+            }
+        });
+    }
+private:
+    asio::ip::tcp::acceptor acceptor;
+};
+
+// keeps `concurrency` request machines running until `total` have finished
+template<typename Machine, typename ...Args>
+static double run(asio::io_service& io, std::size_t total, std::size_t concurrency, Args& ...args) {
+    std::vector<std::unique_ptr<Machine>> slots(concurrency);
+    std::size_t started = 0, finished = 0, ok = 0;
+    std::function<void(std::size_t)> start = [&](std::size_t i) {
+        if (started == total) {
+            return;
+        }
+        ++started;
+        slots[i] = std::make_unique<Machine>(io);
+        slots[i]->async_wait([&, i](bool answered) {
+            ok += answered;
+            if (++finished == total) {
+                return io.stop();
+            }
+            // not destroyed from within its own completion
+            asio::post(io, [&, i] { start(i); });
+        }, args...);
+    };
+
+    auto begin = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < concurrency; ++i) {
+        start(i);
+    }
+    io.restart();
+    io.run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    if (ok != total) {
+        log("{} of {} requests failed", total - ok, total);
+    }
+    return total / elapsed.count();
+}
+
+int main(int argc, char *argv[]) {
+    std::size_t total = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+    std::size_t concurrency = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16;
+
+    asio::io_service io;
+    echo_server server(io);
+    auto ep = server.endpoint();
+
+    auto cold = run<cold_request>(io, total, concurrency, ep);
+    log("connect per request: {:.0f} requests/s", cold);
+
+    afsm::io::pool_options opts;
+    opts.connections = concurrency;
+    auto& pool = asio::use_service<afsm::io::connection_pools>(io).get(ep, opts);
+    auto pooled = run<pooled_request>(io, total, concurrency, pool);
+    log("pooled connections:  {:.0f} requests/s", pooled);
+
+    pool.stop();
+    server.stop();
+    return 0;
+}
@@ -0,0 +1,70 @@
+// Prints how many machines of another process are in each state, read from
+// the shared memory table of its afsm::state_registry. Nothing is sent to the
+// monitored process.
+//
+//   state_top <table name> [slot]     e.g. state_top /afsm-tcp_client
+//   state_top <table name> -w         refresh every second
+
+// ours
+#include <afsm/monitor.hpp>
+
+// thirdparty
+#include <fmt/format.h>
+
+// std
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string_view>
+#include <thread>
+
+static void print_counts(const afsm::state_table& table) {
+    fmt::print("pid {}, {} of {} slots used\n", table.pid(), table.used(), table.capacity());
+    std::string_view machine;
+    for (auto& c : table.counts()) {
+        if (c.machine != machine) {
+            machine = c.machine;
+            fmt::print("{}\n", machine);
+        }
+        if (c.machines) {
+            fmt::print("  {:>10}  {}\n", c.machines, c.state);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fmt::print(stderr, "usage: {} <table name> [slot|-w]\n", argv[0]);
+        return 1;
+    }
+
+    try {
+        auto table = afsm::state_table::open(argv[1]);
+        std::string_view arg = argc > 2 ? argv[2] : "";
+        if (arg == "-w") {
+            for (;;) {
+                fmt::print("\033[H\033[2J");
+                print_counts(table);
+                std::fflush(stdout);
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+            }
+        }
+
+        if (!arg.empty()) {
+            auto [machine, state] = table.state_of(std::strtoul(argv[2], nullptr, 10));
+            if (machine.empty()) {
+                fmt::print("slot {} is not in use\n", argv[2]);
+                return 1;
+            }
+            fmt::print("{}: {}\n", machine, state);
+            return 0;
+        }
+
+        print_counts(table);
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "{}\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -38,8 +38,9 @@ public:
 
 class connected {
 public:
-    connected(asio::ip::tcp::socket& sock) noexcept: sock(sock) {}
+    connected(asio::ip::tcp::socket& sock, const asio::ip::tcp::endpoint& ep) noexcept: sock(sock), ep(ep) {}
     std::reference_wrapper<asio::ip::tcp::socket> sock;
+    asio::ip::tcp::endpoint ep;
 
     operator asio::ip::tcp::socket&() const {
         return sock.get();
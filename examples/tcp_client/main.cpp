@@ -1,3 +1,11 @@
+// Prints the client's transitions as graphviz, then keeps a connection to
+// 127.0.0.1:5555 until SIGINT.
+//
+//   tcp_client [--monitor] [--checkpoint <file>]
+//
+//   --monitor      `state_top /afsm-tcp_client` shows the client's state from outside
+//   --checkpoint   a client restarted with the same file carries on where the
+//                  last one was stopped
 
 // ours
 #include "tcp_client.hpp"
@@ -8,14 +16,56 @@
 // thirdparty
 #include <asio.hpp>
 
+// std
+#include <optional>
+#include <string>
+#include <string_view>
+
 int main(int argc, char *argv[]) {
+    bool monitored = false;
+    std::optional<std::string> checkpoint_path;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg(argv[i]);
+        if (arg == "--monitor") {
+            monitored = true;
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpoint_path = argv[++i];
+        } else {
+            log("usage: {} [--monitor] [--checkpoint <file>]", argv[0]);
+            return 1;
+        }
+    }
+
     std::string server_address = "127.0.0.1";
     asio::io_service io;
 
     afsm::visitor::graphviz_export exporter(std::cout);
     client::static_visit(exporter);
 
+    // at most 50 reconnect attempts per second, bursts of 10
+    asio::use_service<afsm::io::token_bucket>(io).configure(50, 10);
+
+    std::optional<afsm::state_registry> registry;
+    if (monitored) {
+        registry.emplace("/afsm-tcp_client", 16);
+    }
+
+    std::optional<afsm::checkpoint_file> checkpoint;
+    if (checkpoint_path) {
+        checkpoint.emplace(*checkpoint_path, 1);
+        if (checkpoint->resumable()) {
+            log("resuming from {}", checkpoint->path());
+        }
+    }
+
+    shared_client_config config(client_config{server_address, "5555"});
     client c(io);
+    if (registry) {
+        c.monitor(*registry);
+    }
+    if (checkpoint) {
+        c.checkpoint(*checkpoint, 0);
+    }
     asio::signal_set sigs(io, SIGINT);
 
     c.async_wait([&](const std::error_code& ec) {
@@ -25,7 +75,7 @@ int main(int argc, char *argv[]) {
 
         sigs.cancel();
         log("client done");
-    }, server_address, "5555");
+    }, config);
 
     sigs.async_wait([&](const std::error_code& ec, int signo) {
         if (ec) {
@@ -34,6 +84,9 @@ int main(int argc, char *argv[]) {
         }
 
         log("got SIGINT, exiting");
+        if (checkpoint) {
+            checkpoint->freeze();
+        }
         c.cancel();
     });
     io.run();
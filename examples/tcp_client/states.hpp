@@ -7,41 +7,53 @@
 #include <test_state_base.hpp>
 
 #include <afsm/state.hpp>
+#include <afsm/io/framed_reader.hpp>
+#include <afsm/io/rehome.hpp>
+#include <afsm/io/resolver_cache.hpp>
+#include <afsm/io/token_bucket.hpp>
+#include <afsm/io/write_queue.hpp>
 #include <afsm/util/type_name.hpp>
 
 // thirdparty
 #include <asio.hpp>
 
 // std
-#include <cmath>
+#include <chrono>
 #include <functional>
-#include <string>
+#include <string_view>
 #include <system_error>
 #include <variant>
 
 class resolving : public test_state_base<resolving, failed, resolved, terminated> {
 public:
-    resolving(asio::io_service& io, const std::string& addr, const std::string& service) :
+    // views into the context's config snapshot, which outlives the state
+    resolving(asio::io_service& io, std::string_view addr, std::string_view service) :
         test_state_base(io),
-        resolver(io),
+        cache(asio::use_service<afsm::io::resolver_cache>(io)),
         addr(addr),
-        service(service)
+        service(service),
+        ticket(0)
     {}
 
     virtual void on_enter() override {
-        resolver.async_resolve(addr, service, track([this](const std::error_code& ec, asio::ip::tcp::resolver::iterator it) {
-            ec ? complete<failed>(ec) : complete<resolved>(*it);
+        if (auto eps = cache.lookup(addr, service)) {
+            return complete<resolved>(eps->front());
+        }
+
+        ticket = cache.async_resolve(addr, service, track([this](const std::error_code& ec, afsm::io::resolver_cache::endpoints_ptr eps) {
+            ec ? complete<failed>(ec) : complete<resolved>(eps->front());
         }));
     }
 
     virtual void cancel() override {
         complete<terminated>();
-        resolver.cancel();
+        cache.cancel(ticket);
     }
 private:
-    asio::ip::tcp::resolver resolver;
-    std::string             addr;
-    std::string             service;
+    afsm::io::resolver_cache&           cache;
+    std::string_view                    addr;
+    std::string_view                    service;
+    afsm::io::resolver_cache::ticket    ticket;
 };
 
 class connecting : public test_state_base<connecting, failed, connected, terminated> {
@@ -54,7 +66,7 @@ public:
 
     virtual void on_enter() override {
         sock.async_connect(ep, track([this](const std::error_code& ec) {
-            ec ? complete<failed>(ec) : complete<connected>(sock);
+            ec ? complete<failed>(ec) : complete<connected>(sock, ep);
         }));
     }
 
@@ -62,23 +74,61 @@ public:
         complete<terminated>();
         sock.cancel();
     }
+
+    const asio::ip::tcp::endpoint& endpoint() const {
+        return ep;
+    }
 private:
     asio::ip::tcp::socket   sock;
     asio::ip::tcp::endpoint ep;
 };
 
-class online : public test_state_base<online, failed, terminated> {
+class online;
+
+// called for every line received while online, instead of logging it
+using frame_hook = std::function<void(std::string_view)>;
+// called once a connection is up, online::outbox() feeds it from any thread
+using connect_hook = std::function<void(online&)>;
+
+class online : public test_state_base<online, failed, afsm::io::send_failed, terminated> {
 public:
-    online(asio::io_service& io, asio::ip::tcp::socket& sock) :
+    using outbox_type = afsm::io::write_queue<online>::sender;
+
+    online(asio::io_service& io, const connected& ev, const frame_hook& on_frame, const connect_hook& on_connect) :
         test_state_base(io),
-        sock(std::move(sock)),
+        sock(afsm::io::rehome(ev.sock.get(), io)),
+        peer(ev.ep),
+        reader(this->sock),
+        out(*this, this->sock),
+        on_frame(on_frame),
+        on_connect(on_connect),
+        moved_in(false),
         timer(io),
-        extend(false)
+        superseded(0)
+    {}
+
+    // the same connection continued on another io_service, see state_machine::migrate()
+    online(asio::io_service& io, online&& from) :
+        test_state_base(io),
+        sock(afsm::io::rehome(from.sock, io)),
+        peer(from.peer),
+        reader(this->sock, std::move(from.reader)),
+        out(*this, this->sock, std::move(from.out)),
+        on_frame(from.on_frame),
+        on_connect(from.on_connect),
+        moved_in(true),
+        timer(io),
+        superseded(0)
     {}
 
     virtual void on_enter() override {
         start_read_socket();
         start_wait_timer();
+        if (moved_in) {
+            out.resume();
+        } else if (on_connect) {
+            on_connect(*this);
+        }
     }
 
     virtual void cancel() override {
@@ -87,28 +137,53 @@ public:
         timer.cancel();
     }
 
+    virtual void on_suspend() override {
+        sock.cancel();
+        timer.cancel();
+    }
+
+    const asio::ip::tcp::endpoint& endpoint() const {
+        return peer;
+    }
+
+    // lines sent to the peer, written in batches
+    outbox_type outbox() const {
+        return out.get_sender();
+    }
 private:
     void start_read_socket() {
-        using namespace std::literals;
-        asio::async_read_until(sock, asio::dynamic_buffer(rx_buffer), "\n"sv, track([this] (const std::error_code& ec, size_t bytes_transferred) {
+        reader.async_read_frames(track([this] (const std::error_code& ec, auto& lines) {
+            for (std::string_view line : lines) {
+                if (on_frame) {
+                    on_frame(line);
+                } else {
+                    log("got {}", line);
+                }
+            }
+
+            if (!active()) {
+                return;
+            }
+
             if (ec) {
                 return complete<failed>(ec);
             }
-
-            log("got {}", rx_buffer);
-            rx_buffer.clear();
             start_read_socket();
-            extend = true;
             start_wait_timer();
         }));
     }
 
     void start_wait_timer() {
-        timer.expires_from_now(std::chrono::seconds(10));
+        // each wait cut short by a restart completes with operation_aborted
+        superseded += timer.expires_from_now(std::chrono::seconds(10));
         timer.async_wait(track([this](const std::error_code& ec) {
+            if (!active()) {
+                return;
+            }
+
             if (ec) {
-                if (ec == asio::error::operation_aborted && extend) {
-                    extend = false;
+                if (ec == asio::error::operation_aborted && superseded > 0) {
+                    --superseded;
                     return;
                 }
 
@@ -119,32 +194,55 @@ private:
         }));
     }
 private:
-    asio::ip::tcp::socket   sock;
-    asio::steady_timer      timer;
-    bool                    extend;
-    std::string             rx_buffer;
+    asio::ip::tcp::socket               sock;
+    asio::ip::tcp::endpoint             peer;
+    afsm::io::framed_reader<>           reader;
+    afsm::io::write_queue<online>       out;
+    const frame_hook&                   on_frame;
+    const connect_hook&                 on_connect;
+    bool                                moved_in;
+    asio::steady_timer                  timer;
+    std::size_t                         superseded;
 };
 
 class backoff : public test_state_base<backoff, retry, failed, terminated> {
 public:
-    backoff(asio::io_service& io, std::chrono::seconds cooldown) :
+    backoff(asio::io_service& io, std::chrono::milliseconds cooldown) :
         test_state_base(io),
-        timer(io)
+        timer(io),
+        admission(asio::use_service<afsm::io::token_bucket>(io)),
+        ticket(0)
     {
         timer.expires_from_now(cooldown);
     }
 
     virtual void on_enter() override {
         timer.async_wait(track([this](const std::error_code& ec) {
-            ec ? complete<failed>(ec) : complete<retry>();
+            if (ec || !active()) {
+                return complete<failed>(ec);
+            }
+
+            // retries of the whole fleet are admitted at a bounded rate
+            ticket = admission.async_acquire(track([this](const std::error_code& ec) {
+                ec ? complete<failed>(ec) : complete<retry>();
+            }));
         }));
     }
 
     virtual void cancel() override {
+        // also when the timer already fired and its handler is queued
+        complete<terminated>();
         timer.cancel();
+        admission.cancel(ticket);
+    }
+
+    std::chrono::steady_clock::time_point deadline() const {
+        return timer.expiry();
     }
 private:
-    asio::steady_timer timer;
+    asio::steady_timer                  timer;
+    afsm::io::token_bucket&             admission;
+    afsm::io::token_bucket::ticket      ticket;
 };
 
 struct completed {
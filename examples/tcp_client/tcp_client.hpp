@@ -4,21 +4,54 @@
 #include "events.hpp"
 #include "states.hpp"
 
+#include <afsm/checkpoint.hpp>
 #include <afsm/state_machine.hpp>
+#include <afsm/util/backoff.hpp>
+#include <afsm/util/shared_config.hpp>
 
 // thirdparty
 #include <asio.hpp>
 
 // std
+#include <algorithm>
+#include <chrono>
 #include <string>
+#include <string_view>
 #include <cstdint>
+#include <functional>
+#include <utility>
+
+// where to connect, shared by every client of a fleet
+struct client_config {
+    std::string     host;
+    std::string     service;
+};
+
+using shared_client_config = afsm::util::shared_config<client_config>;
 
 struct context {
-    context(asio::io_service& io, const std::string& host, const std::string& service) : io(io), host(host), service(service), nbackoff(0) {}
-    asio::io_service&       io;
-    std::string             host;
-    std::string             service;
-    size_t                  nbackoff;
+    context(asio::io_service& io, const shared_client_config& source, frame_hook on_frame = {}, connect_hook on_connect = {}, std::uint64_t* entered = nullptr) :
+        io(io),
+        source(source),
+        on_frame(std::move(on_frame)),
+        on_connect(std::move(on_connect)),
+        entered(entered)
+    {}
+
+    // every state is built through a state_factory below
+    void count_state() {
+        if (entered) {
+            ++*entered;
+        }
+    }
+
+    std::reference_wrapper<asio::io_service>    io;         // rebound when the client migrates
+    const shared_client_config&                 source;
+    shared_client_config::snapshot              config;     // taken on every resolve, so reloads apply on reconnect
+    frame_hook                                  on_frame;
+    connect_hook                                on_connect;
+    std::uint64_t*                              entered;    // states entered by this client, if set
+    afsm::util::decorrelated_jitter             delay;
 };
 
 namespace afsm {
@@ -26,14 +59,25 @@ namespace afsm {
 template<typename Event>
 struct state_factory<resolving, Event, context> {
     auto operator()(const Event&, context& ctx) const {
-        return std::make_tuple(std::ref(ctx.io), ctx.host, ctx.service);
+        ctx.count_state();
+        ctx.config = ctx.source.load();
+        return std::make_tuple(std::ref(ctx.io), std::string_view(ctx.config->host), std::string_view(ctx.config->service));
     }
 };
 
 template<typename Event>
 struct state_factory<online, Event, context> {
     auto operator()(const Event& ev, context& ctx) const {
-        ctx.nbackoff = 0;
+        ctx.count_state();
+        ctx.delay.reset();
+        return std::make_tuple(std::ref(ctx.io), ev, std::cref(ctx.on_frame), std::cref(ctx.on_connect));
+    }
+};
+
+template<typename Event>
+struct state_factory<connecting, Event, context> {
+    auto operator()(const Event& ev, context& ctx) const {
+        ctx.count_state();
         return std::make_tuple(std::ref(ctx.io), ev);
     }
 };
@@ -41,8 +85,46 @@ struct state_factory<online, Event, context> {
 template<typename Event>
 struct state_factory<backoff, Event, context> {
     auto operator()(const Event&, context& ctx) const {
-        std::chrono::seconds timeout(std::min<int>(16, std::pow(2, ctx.nbackoff++)));
-        return std::make_tuple(std::ref(ctx.io), timeout);
+        ctx.count_state();
+        return std::make_tuple(std::ref(ctx.io), ctx.delay.next());
+    }
+};
+
+// What a client resumes in after a restart: a backoff with the delay it had
+// left, a connection by connecting to the same peer, without resolving again.
+// A client resolving starts over.
+template<>
+struct state_checkpoint<backoff, context> {
+    void save(const backoff& s, const context&, checkpoint_writer& w) const {
+        w.write_deadline(s.deadline());
+    }
+
+    auto restore(checkpoint_reader& r, context& ctx) const {
+        auto left = std::max(r.read_deadline() - std::chrono::steady_clock::now(), std::chrono::steady_clock::duration::zero());
+        return std::make_tuple(std::ref(ctx.io), std::chrono::duration_cast<std::chrono::milliseconds>(left));
+    }
+};
+
+template<>
+struct state_checkpoint<connecting, context> {
+    void save(const connecting& s, const context&, checkpoint_writer& w) const {
+        w.write_string(s.endpoint().address().to_string());
+        w.write(s.endpoint().port());
+    }
+
+    auto restore(checkpoint_reader& r, context& ctx) const {
+        auto addr = asio::ip::make_address(r.read_string());
+        return std::make_tuple(std::ref(ctx.io), asio::ip::tcp::endpoint(addr, r.read<unsigned short>()));
+    }
+};
+
+template<>
+struct state_checkpoint<online, context> {
+    using as = connecting;
+
+    void save(const online& s, const context&, checkpoint_writer& w) const {
+        w.write_string(s.endpoint().address().to_string());
+        w.write(s.endpoint().port());
     }
 };
 
@@ -63,6 +145,7 @@ struct client_traits {
         afsm::transition<connecting, terminated, completed>,
 
         afsm::transition<online, failed, backoff>,
+        afsm::transition<online, afsm::io::send_failed, backoff>,
         afsm::transition<online, terminated, completed>,
 
         afsm::transition<backoff, retry, resolving>,
@@ -0,0 +1,480 @@
+// End-to-end load test of the tcp_client example: N client machines against
+// an in-process afsm::io::server, through resolving, connecting, online and
+// backoff exactly as in production.
+//
+//   tcp_load [mode=line] [clients=100,1000] [seconds=5]
+//
+// Server modes, every line the server sends carries its send time:
+//   echo   one line on connect, then echoes whatever the client sends; while
+//          sampling every client answers each line with a fresh timestamp
+//   line   one line every 100ms per connection
+//   flaky  like line, but drops each connection after 0.2-2s
+//
+// For every N it reports the connect rate (until every client got its first
+// line), the states the clients entered per second over the whole run
+// (connecting, the steady phase, the reconnect storm), p50/p99 line latency
+// over the steady phase, RSS
+// per client (including its server session, both live in this process) and
+// the time until every client is served again after the server dropped all
+// connections at once.
+
+// ours
+#include <bench.hpp>
+#include <tcp_client/tcp_client.hpp>
+
+#include <afsm/io/acceptor.hpp>
+#include <afsm/io/token_bucket.hpp>
+#include <afsm/monitor.hpp>
+#include <afsm/sched_stats.hpp>
+#include <afsm/state.hpp>
+#include <afsm/state_machine.hpp>
+
+// thirdparty
+#include <asio.hpp>
+#include <fmt/format.h>
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// system
+#include <malloc.h>
+#include <unistd.h>
+
+enum class server_mode { echo, line, flaky };
+
+struct settings {
+    server_mode                 mode = server_mode::line;
+    std::chrono::milliseconds   interval = std::chrono::milliseconds(100);
+    unsigned short              port = 5557;
+};
+
+static settings config;
+
+static std::int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// server side
+
+class peer_gone {};
+class session_stopped {};
+
+class serving : public afsm::state<peer_gone, session_stopped> {
+public:
+    serving(asio::io_service& io, asio::ip::tcp::socket& sock) :
+        state(io),
+        sock(sock),
+        ticker(io),
+        lifetime(io),
+        writing(false)
+    {}
+
+    virtual void on_enter() override {
+        send(fmt::format("{}\n", now_ns()));
+        read();
+        if (config.mode != server_mode::echo) {
+            tick();
+        }
+
+        if (config.mode == server_mode::flaky) {
+            thread_local std::minstd_rand rng(std::random_device{}());
+            lifetime.expires_from_now(std::chrono::milliseconds(std::uniform_int_distribution<int>(200, 2000)(rng)));
+            lifetime.async_wait(track([this](const std::error_code& ec) {
+                if (!ec) {
+                    complete<peer_gone>();
+                }
+            }));
+        }
+    }
+
+    virtual void cancel() override {
+        complete<session_stopped>();
+        sock.cancel();
+        ticker.cancel();
+        lifetime.cancel();
+    }
+private:
+    // a completion already queued when the state was cancelled must not re-arm
+    void read() {
+        if (!active()) {
+            return;
+        }
+
+        sock.async_read_some(asio::buffer(in), track([this](const std::error_code& ec, std::size_t n) {
+            if (ec) {
+                return complete<peer_gone>();
+            }
+
+            if (config.mode == server_mode::echo) {
+                send(std::string(in, n));
+            }
+            read();
+        }));
+    }
+
+    void tick() {
+        if (!active()) {
+            return;
+        }
+
+        ticker.expires_from_now(config.interval);
+        ticker.async_wait(track([this](const std::error_code& ec) {
+            if (ec) {
+                return;
+            }
+
+            send(fmt::format("{}\n", now_ns()));
+            tick();
+        }));
+    }
+
+    // a line is skipped while the previous one is still being written
+    void send(std::string line) {
+        if (writing || !active()) {
+            return;
+        }
+
+        out = std::move(line);
+        writing = true;
+        asio::async_write(sock, asio::buffer(out), track([this](const std::error_code& ec, std::size_t) {
+            writing = false;
+            if (ec) {
+                complete<peer_gone>();
+            }
+        }));
+    }
+private:
+    asio::ip::tcp::socket&  sock;
+    asio::steady_timer      ticker;
+    asio::steady_timer      lifetime;
+    char                    in[512];
+    std::string             out;
+    bool                    writing;
+};
+
+struct session_closed {
+    template<typename ...Args>
+    session_closed(Args&& ...) {}
+};
+
+struct session_context {
+    session_context(asio::io_service& io, asio::ip::tcp::socket&& sock) :
+        io(io),
+        sock(std::move(sock))
+    {}
+
+    asio::io_service&       io;
+    asio::ip::tcp::socket   sock;
+};
+
+namespace afsm {
+template<typename Event>
+struct state_factory<serving, Event, session_context> {
+    auto operator()(const Event&, session_context& ctx) const {
+        return std::make_tuple(std::ref(ctx.io), std::ref(ctx.sock));
+    }
+};
+
+template<typename Event>
+struct result_factory<Event, session_context> {
+    bool operator()(const Event&, session_context&) const {
+        return true;
+    }
+};
+} // namespace afsm
+
+struct session_traits {
+    using start_state = serving;
+    using end_state = session_closed;
+    using context = session_context;
+    using result = bool;
+    using transitions = afsm::transitions<
+        afsm::transition<serving, peer_gone, session_closed>,
+        afsm::transition<serving, session_stopped, session_closed>
+    >;
+};
+
+using session = afsm::state_machine<session_traits>;
+using server = afsm::io::server<session>;
+
+// client side
+
+// every client records the generation in which it last got a line; a new
+// generation starts when the server drops everybody
+struct progress {
+    explicit progress(std::size_t n) : seen(n, 0), generation(1) {
+        for (auto& r : ready) {
+            r = 0;
+        }
+    }
+
+    std::vector<std::uint32_t>          seen;
+    std::atomic<std::uint32_t>          generation;
+    std::atomic<std::size_t>            ready[2];
+    std::atomic<bool>                   sampling{false};
+};
+
+// one per client io_service, only touched by its thread
+struct shard_stats {
+    static constexpr std::size_t max_samples = 1 << 21;
+    std::vector<std::uint32_t> latency_us;
+};
+
+static std::uint32_t percentile(std::vector<std::uint32_t>& v, double p) {
+    if (v.empty()) {
+        return 0;
+    }
+
+    auto nth = v.begin() + static_cast<std::ptrdiff_t>(p * (v.size() - 1));
+    std::nth_element(v.begin(), nth, v.end());
+    return *nth;
+}
+
+struct report {
+    std::size_t     clients;
+    double          connect_rate;
+    double          transitions_rate;
+    double          rss_per_client;
+    std::uint32_t   p50_us;
+    std::uint32_t   p99_us;
+    double          recovery_ms;
+    // completions already queued when an afsm completion was posted, worst shard
+    std::uint64_t   queued_ahead_p50 = 0;
+    std::uint64_t   queued_ahead_p99 = 0;
+    std::uint64_t   queued_ahead_max = 0;
+};
+
+static report run(std::size_t n, std::chrono::seconds steady, std::size_t nshards) {
+    report rep{n, 0, 0, 0, 0, 0, -1};
+    malloc_trim(0);
+    auto rss_before = rss_bytes();
+
+    // server: one io_service accepting, sessions spread over shards
+    asio::io_service server_io;
+    std::vector<std::unique_ptr<asio::io_service>> server_shards;
+    std::vector<asio::io_service*> server_shard_ptrs;
+    for (std::size_t i = 0; i < nshards; ++i) {
+        server_shards.push_back(std::make_unique<asio::io_service>());
+        server_shard_ptrs.push_back(server_shards.back().get());
+    }
+    afsm::io::session_pool<session> pool(n, server_shard_ptrs);
+    afsm::io::acceptor_options opts;
+    opts.concurrent_accepts = 64;
+    server srv(server_io);
+    srv.async_wait([](const std::error_code& ec) {
+        if (ec) {
+            fmt::print(stderr, "server failed: {}\n", ec.message());
+        }
+    }, asio::ip::tcp::endpoint(asio::ip::address_v4::any(), config.port), pool, opts);
+
+    // clients: spread over the shards and over 127.0.0.1-8, so the ephemeral
+    // port range of one destination address does not cap N
+    std::vector<std::unique_ptr<asio::io_service>> client_shards;
+    std::vector<shard_stats> stats(nshards);
+    progress prog(n);
+    // `state_top /afsm-tcp_load-<pid> -w` follows the fleet while the test
+    // runs, the pid keeps concurrent runs apart
+    afsm::state_registry registry(fmt::format("/afsm-tcp_load-{}", ::getpid()), n);
+    // one config per destination address, shared by every client dialing it
+    std::vector<std::unique_ptr<shared_client_config>> configs;
+    for (std::size_t a = 0; a < 8; ++a) {
+        configs.push_back(std::make_unique<shared_client_config>(client_config{fmt::format("127.0.0.{}", 1 + a), std::to_string(config.port)}));
+    }
+
+    std::deque<client> clients;
+    // states entered per client, each only touched by the client's shard
+    std::vector<std::uint64_t> entered(n);
+    std::vector<std::optional<online::outbox_type>> outboxes(n);
+    std::atomic<std::size_t> finished(0);
+    for (std::size_t i = 0; i < nshards; ++i) {
+        client_shards.push_back(std::make_unique<asio::io_service>());
+        // the whole fleet reconnects after the storm, admitted at a bounded rate
+        asio::use_service<afsm::io::token_bucket>(*client_shards.back()).configure(20000 / nshards + 1, 1000);
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        clients.emplace_back(*client_shards[i % nshards]).monitor(registry);
+    }
+
+    std::vector<asio::io_service::work> work;
+    std::vector<std::thread> threads;
+    for (auto* io : {&server_io}) {
+        work.emplace_back(*io);
+        threads.emplace_back([io] { io->run(); });
+    }
+    for (auto& io : server_shards) {
+        work.emplace_back(*io);
+        threads.emplace_back([&io] { io->run(); });
+    }
+    for (auto& io : client_shards) {
+        work.emplace_back(*io);
+        threads.emplace_back([&io] { io->run(); });
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < n; ++i) {
+        auto shard = i % nshards;
+        auto* target = configs[i % 8].get();
+        // only touched on the client's shard
+        auto on_connect = [&outboxes, i](online& s) {
+            outboxes[i] = s.outbox();
+        };
+        auto on_frame = [&prog, &stats, &outboxes, i, shard](std::string_view line) {
+            auto g = prog.generation.load(std::memory_order_relaxed);
+            if (prog.seen[i] < g) {
+                prog.seen[i] = g;
+                prog.ready[g - 1].fetch_add(1, std::memory_order_relaxed);
+            }
+
+            std::int64_t sent = 0;
+            if (prog.sampling.load(std::memory_order_relaxed) && std::from_chars(line.data(), line.data() + line.size(), sent).ec == std::errc()) {
+                auto& samples = stats[shard].latency_us;
+                if (samples.size() < shard_stats::max_samples) {
+                    samples.push_back(static_cast<std::uint32_t>((now_ns() - sent) / 1000));
+                }
+                if (config.mode == server_mode::echo && outboxes[i]) {
+                    outboxes[i]->send(fmt::format("{}\n", now_ns()));
+                }
+            }
+        };
+        asio::post(*client_shards[shard], [&, i, target, on_frame, on_connect]() {
+            clients[i].async_wait([&finished](const std::error_code&) {
+                finished.fetch_add(1, std::memory_order_relaxed);
+            }, *target, on_frame, on_connect, &entered[i]);
+        });
+    }
+
+    auto deadline = std::chrono::milliseconds(60000);
+    if (wait_until([&] { return prog.ready[0].load() == n; }, deadline)) {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+        rep.connect_rate = n / elapsed.count();
+    }
+    rep.rss_per_client = (static_cast<double>(rss_bytes()) - rss_before) / n;
+
+    // steady phase
+    prog.sampling = true;
+    if (config.mode == server_mode::echo) {
+        // the first line of every ping-pong, the answers keep it going
+        for (std::size_t i = 0; i < n; ++i) {
+            asio::post(*client_shards[i % nshards], [&outboxes, i] {
+                if (outboxes[i]) {
+                    outboxes[i]->send(fmt::format("{}\n", now_ns()));
+                }
+            });
+        }
+    }
+    std::this_thread::sleep_for(steady);
+    prog.sampling = false;
+
+    // reconnect storm: the server drops every connection at once
+    prog.generation = 2;
+    auto storm = std::chrono::steady_clock::now();
+    pool.cancel_all();
+    if (wait_until([&] { return prog.ready[1].load() == n; }, deadline)) {
+        rep.recovery_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - storm).count();
+    }
+
+    // teardown
+    for (std::size_t i = 0; i < n; ++i) {
+        asio::post(*client_shards[i % nshards], [&clients, i] { clients[i].cancel(); });
+    }
+    wait_until([&] { return finished.load() == n; });
+    asio::post(server_io, [&srv] { srv.cancel(); });
+    pool.cancel_all();
+    wait_until([&] { return pool.active() == 0; });
+    work.clear();
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+    rep.transitions_rate = std::accumulate(entered.begin(), entered.end(), std::uint64_t(0)) / elapsed.count();
+
+    std::vector<std::uint32_t> latency;
+    for (auto& s : stats) {
+        latency.insert(latency.end(), s.latency_us.begin(), s.latency_us.end());
+    }
+    rep.p50_us = percentile(latency, 0.50);
+    rep.p99_us = percentile(latency, 0.99);
+    for (auto& io : client_shards) {
+        auto& ahead = asio::use_service<afsm::queue_depth>(*io).found_on_post();
+        rep.queued_ahead_p50 = std::max(rep.queued_ahead_p50, ahead.percentile(0.5));
+        rep.queued_ahead_p99 = std::max(rep.queued_ahead_p99, ahead.percentile(0.99));
+        rep.queued_ahead_max = std::max(rep.queued_ahead_max, ahead.max());
+    }
+    return rep;
+}
+
+static std::vector<std::size_t> parse_counts(const char* arg) {
+    std::vector<std::size_t> counts;
+    std::string_view s(arg);
+    while (!s.empty()) {
+        std::size_t v = 0;
+        auto r = std::from_chars(s.data(), s.data() + s.size(), v);
+        if (r.ec == std::errc() && v > 0) {
+            counts.push_back(v);
+        }
+        auto comma = s.find(',');
+        s = comma == std::string_view::npos ? std::string_view() : s.substr(comma + 1);
+    }
+    return counts;
+}
+
+int main(int argc, char *argv[]) {
+    std::string_view mode = argc > 1 ? argv[1] : "line";
+    if (mode == "echo") {
+        config.mode = server_mode::echo;
+    } else if (mode == "flaky") {
+        config.mode = server_mode::flaky;
+    } else if (mode != "line") {
+        fmt::print(stderr, "usage: {} [echo|line|flaky] [clients=100,1000] [seconds=5]\n", argv[0]);
+        return 1;
+    }
+
+    // larger fleets need 2 * N descriptors and a raised hard limit
+    auto counts = parse_counts(argc > 2 ? argv[2] : "100,1000");
+    std::chrono::seconds steady(argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 5);
+    std::size_t nshards = std::max(1u, std::thread::hardware_concurrency());
+
+    auto limit = raise_fd_limit(2 * *std::max_element(counts.begin(), counts.end()) + 256);
+    fmt::print("mode {}, {} shards, RLIMIT_NOFILE {}\n", mode, nshards, limit);
+    fmt::print("{:>8} {:>12} {:>14} {:>12} {:>9} {:>9} {:>12}\n", "clients", "connects/s", "transitions/s", "rss/client", "p50 us", "p99 us", "recovery ms");
+    for (auto n : counts) {
+        if (2 * n + 256 > limit) {
+            fmt::print("{:>8} skipped, needs {} descriptors\n", n, 2 * n + 256);
+            continue;
+        }
+
+        auto r = run(n, steady, nshards);
+        fmt::print("{:>8} {:>12.0f} {:>14.0f} {:>12.0f} {:>9} {:>9} {:>12.1f}\n", r.clients, r.connect_rate, r.transitions_rate, r.rss_per_client, r.p50_us, r.p99_us, r.recovery_ms);
+        if constexpr (afsm::sched_stats_enabled) {
+            fmt::print("{:>8} completions queued ahead p50/p99/max {}/{}/{}\n", "", r.queued_ahead_p50, r.queued_ahead_p99, r.queued_ahead_max);
+        }
+    }
+
+    if constexpr (afsm::sched_stats_enabled) {
+        // where transitions wait, all runs together
+        fmt::print("\n{:<40} {:>10} {:>19} {:>19} {:>19}\n", "machine", "transitions", "drain p50/p99 us", "queue p50/p99 us", "construct p50/p99 us");
+        afsm::sched_stats_registry::instance().for_each([](const std::string& machine, const afsm::sched_stats& s) {
+            auto us = [](const afsm::latency_histogram& h, double p) {
+                return std::chrono::duration<double, std::micro>(h.percentile(p)).count();
+            };
+            fmt::print("{:<40.40} {:>10} {:>9.1f}/{:<9.1f} {:>9.1f}/{:<9.1f} {:>9.1f}/{:<9.1f}\n", machine, s.queue.count(),
+                us(s.drain, 0.5), us(s.drain, 0.99), us(s.queue, 0.5), us(s.queue, 0.99), us(s.construct, 0.5), us(s.construct, 0.99));
+        });
+    }
+    return 0;
+}
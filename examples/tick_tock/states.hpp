@@ -5,56 +5,52 @@
 
 #include <test_state_base.hpp>
 
+#include <afsm/periodic.hpp>
 #include <afsm/state.hpp>
 
 // thirdparty
 #include <asio.hpp>
 
-// std
-#include <chrono>
-
 class ticked : public test_state_base<ticked, tock, terminated> {
 public:
-    ticked(asio::io_service& io) :
+    ticked(asio::io_service& io, afsm::cadence& beat) :
         test_state_base(io),
-        timer(io)
+        beat(beat)
     {}
 
     virtual void on_enter() override {
-        timer.expires_from_now(std::chrono::seconds(3));
-        timer.async_wait(track([this](const std::error_code& ec) {
+        beat.async_wait(track([this](const std::error_code& ec, const afsm::elapsed&) {
             ec ? complete<terminated>(ec) : complete<tock>();
         }));
     }
 
     virtual void cancel() override {
         complete<terminated>();
-        timer.cancel();
+        beat.cancel();
     }
 private:
-    asio::steady_timer timer;
+    afsm::cadence& beat;
 };
 
 class tocked : public test_state_base<tocked, tick, terminated> {
 public:
-    tocked(asio::io_service& io) :
+    tocked(asio::io_service& io, afsm::cadence& beat) :
         test_state_base(io),
-        timer(io)
+        beat(beat)
     {}
 
     virtual void on_enter() override {
-        timer.expires_from_now(std::chrono::seconds(3));
-        timer.async_wait(track([this](const std::error_code& ec) {
+        beat.async_wait(track([this](const std::error_code& ec, const afsm::elapsed&) {
             ec ? complete<terminated>(ec) : complete<tick>();
         }));
     }
 
     virtual void cancel() override {
         complete<terminated>();
-        timer.cancel();
+        beat.cancel();
     }
 private:
-    asio::steady_timer timer;
+    afsm::cadence& beat;
 };
 
 struct completed {
@@ -7,22 +7,23 @@
 #include <afsm/state_machine.hpp>
 
 struct context {
-    context(asio::io_service& io) : io(io) {}
+    context(asio::io_service& io) : io(io), beat(io, std::chrono::seconds(3)) {}
     asio::io_service& io;
+    afsm::cadence beat;     // shared by both states, so the phase survives transitions
 };
 
 namespace afsm {
 template<typename Event>
 struct state_factory<ticked, Event, context> {
     auto operator()(const Event&, context& ctx) const {
-        return std::make_tuple(std::ref(ctx.io));
+        return std::make_tuple(std::ref(ctx.io), std::ref(ctx.beat));
     }
 };
 
 template<typename Event>
 struct state_factory<tocked, Event, context> {
     auto operator()(const Event&, context& ctx) const {
-        return std::make_tuple(std::ref(ctx.io));
+        return std::make_tuple(std::ref(ctx.io), std::ref(ctx.beat));
     }
 };
 
@@ -0,0 +1,242 @@
+// Loopback UDP throughput: a sender thread blasts datagrams with sendmmsg
+// while the receiver runs either as an afsm machine taking one transition
+// per recvmmsg batch, or as a plain per-datagram async_receive_from loop.
+//
+//   udp_bench [seconds=2] [payload=64] [batch=64]
+
+// ours
+#include <log.hpp>
+
+#include <afsm/io/datagram.hpp>
+#include <afsm/state.hpp>
+#include <afsm/state_machine.hpp>
+
+// thirdparty
+#include <asio.hpp>
+#include <fmt/format.h>
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+
+using afsm::io::datagrams_received;
+using afsm::io::datagram_failed;
+using afsm::io::datagram_stopped;
+using afsm::io::receiving_datagrams;
+
+struct counters {
+    std::size_t datagrams = 0;
+    std::size_t bytes = 0;
+    std::size_t batches = 0;
+};
+
+class batch_counted {};
+
+// processes one batch, then the machine goes back to receiving
+class counting : public afsm::state<batch_counted, datagram_stopped> {
+public:
+    counting(asio::io_service& io, const afsm::io::datagram_batch& batch, counters& count) :
+        state(io),
+        batch(batch),
+        count(count)
+    {}
+
+    virtual void on_enter() override {
+        for (auto d : batch) {
+            count.bytes += d.data.size();
+        }
+        count.datagrams += batch.size();
+        ++count.batches;
+        complete<batch_counted>();
+    }
+
+    virtual void cancel() override {
+        complete<datagram_stopped>();
+    }
+private:
+    afsm::io::datagram_batch    batch;
+    counters&                   count;
+};
+
+struct stopped {
+    template<typename ...Args>
+    stopped(Args&& ...) {}
+};
+
+struct receiver_context {
+    receiver_context(asio::io_service& io, asio::ip::udp::socket& sock, std::size_t batch) :
+        io(io),
+        sock(sock),
+        udp(sock, batch)
+    {}
+
+    asio::io_service&           io;
+    asio::ip::udp::socket&      sock;
+    afsm::io::batched_udp       udp;
+    counters                    count;
+};
+
+namespace afsm {
+template<typename Event>
+struct state_factory<receiving_datagrams, Event, receiver_context> {
+    auto operator()(const Event&, receiver_context& ctx) const {
+        return std::make_tuple(std::ref(ctx.io), std::ref(ctx.sock), std::ref(ctx.udp));
+    }
+};
+
+template<>
+struct state_factory<counting, datagrams_received, receiver_context> {
+    auto operator()(const datagrams_received& ev, receiver_context& ctx) const {
+        return std::make_tuple(std::ref(ctx.io), ev.batch, std::ref(ctx.count));
+    }
+};
+
+template<typename Event>
+struct result_factory<Event, receiver_context> {
+    counters operator()(const Event&, receiver_context& ctx) const {
+        return ctx.count;
+    }
+};
+} // namespace afsm
+
+struct receiver_traits {
+    using start_state = receiving_datagrams;
+    using end_state = stopped;
+    using context = receiver_context;
+    using result = counters;
+    using transitions = afsm::transitions<
+        afsm::transition<receiving_datagrams, datagrams_received, counting>,
+        afsm::transition<receiving_datagrams, datagram_failed, stopped>,
+        afsm::transition<receiving_datagrams, datagram_stopped, stopped>,
+
+        afsm::transition<counting, batch_counted, receiving_datagrams>,
+        afsm::transition<counting, datagram_stopped, stopped>
+    >;
+};
+
+using receiver = afsm::state_machine<receiver_traits>;
+
+// baseline: one completion per datagram
+struct single_receiver {
+    single_receiver(asio::ip::udp::socket& sock, std::size_t max_datagram) :
+        sock(sock),
+        buf(max_datagram, '\0'),
+        stopped(false)
+    {}
+
+    void start() {
+        if (stopped) {
+            return;
+        }
+
+        sock.async_receive_from(asio::buffer(&buf[0], buf.size()), peer, [this](const std::error_code& ec, std::size_t n) {
+            if (ec) {
+                return;
+            }
+            ++count.datagrams;
+            count.bytes += n;
+            start();
+        });
+    }
+
+    // sticky, unlike a cancel() landing while no receive is outstanding
+    void stop() {
+        stopped = true;
+        sock.cancel();
+    }
+
+    asio::ip::udp::socket&      sock;
+    std::string                 buf;
+    asio::ip::udp::endpoint     peer;
+    counters                    count;
+    bool                        stopped;
+};
+
+struct sender {
+    sender(asio::io_service& io, const asio::ip::udp::endpoint& to, std::size_t payload, std::size_t batch) :
+        sock(io, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0)),
+        udp(sock, batch),
+        to(to),
+        payload(payload, 'x'),
+        sent(0),
+        stop(false)
+    {}
+
+    void start() {
+        while (udp.queue(payload, to)) {}
+        udp.async_flush([this](const std::error_code& ec, std::size_t n) {
+            sent += n;
+            if (!ec && !stop) {
+                start();
+            }
+        });
+    }
+
+    asio::ip::udp::socket       sock;
+    afsm::io::batched_udp       udp;
+    asio::ip::udp::endpoint     to;
+    std::string                 payload;
+    std::size_t                 sent;
+    std::atomic<bool>           stop;
+};
+
+// `receive` runs the receiver for `duration` and stops the sender when it stops
+template<typename Receive>
+static void run(const char* name, std::chrono::seconds duration, std::size_t payload, std::size_t batch, Receive&& receive) {
+    asio::io_service io;
+    asio::ip::udp::socket sock(io, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    sock.set_option(asio::socket_base::receive_buffer_size(8 * 1024 * 1024));
+
+    asio::io_service tx_io;
+    sender s(tx_io, sock.local_endpoint(), payload, batch);
+    s.start();
+    std::thread tx([&] { tx_io.run(); });
+
+    auto started = std::chrono::steady_clock::now();
+    counters count = receive(io, sock, duration, [&s] { s.stop = true; });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+    tx.join();
+
+    log("{}: sent {:.0f}/s, received {:.0f} datagrams/s ({:.1f} MB/s){}", name, s.sent / elapsed.count(),
+        count.datagrams / elapsed.count(), count.bytes / elapsed.count() / 1e6,
+        count.batches ? fmt::format(", {:.1f} datagrams per transition", double(count.datagrams) / count.batches) : std::string());
+}
+
+int main(int argc, char *argv[]) {
+    std::chrono::seconds duration(argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2);
+    std::size_t payload = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 64;
+    std::size_t batch = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 64;
+
+    run("batched machine", duration, payload, batch, [batch](asio::io_service& io, asio::ip::udp::socket& sock, std::chrono::seconds duration, auto stop_sender) {
+        counters result;
+        receiver r(io);
+        r.async_wait([&](const counters& c) { result = c; }, sock, batch);
+
+        asio::steady_timer timer(io, duration);
+        timer.async_wait([&](const std::error_code&) {
+            stop_sender();
+            r.cancel();
+        });
+        io.run();
+        return result;
+    });
+
+    run("per-datagram loop", duration, payload, batch, [payload](asio::io_service& io, asio::ip::udp::socket& sock, std::chrono::seconds duration, auto stop_sender) {
+        single_receiver r(sock, std::max<std::size_t>(payload, 2048));
+        r.start();
+
+        asio::steady_timer timer(io, duration);
+        timer.async_wait([&](const std::error_code&) {
+            stop_sender();
+            r.stop();
+        });
+        io.run();
+        return r.count;
+    });
+    return 0;
+}
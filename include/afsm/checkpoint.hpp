@@ -0,0 +1,408 @@
+#pragma once
+
+// ours
+#include "log.hpp"
+#include "util/type_name.hpp"
+
+// std
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+// system
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace afsm {
+namespace detail {
+
+// Layout of a checkpoint file:
+//
+//   checkpoint_header
+//   (checkpoint_record, payload)[capacity]     record_size bytes each
+//
+// Machine types and states are identified by hashes of their type names, so
+// a rebuilt binary still finds its states whatever their order. A record
+// with an odd seq was being written when the process died and is ignored.
+struct checkpoint_header {
+    static constexpr char magic_value[8] = {'a', 'f', 's', 'm', 'c', 'k', 'p', '1'};
+
+    char                            magic[8];
+    std::uint32_t                   capacity;
+    std::uint32_t                   record_size;
+};
+
+struct checkpoint_record {
+    std::atomic<std::uint32_t>      seq;
+    std::uint32_t                   size;       // payload bytes
+    std::uint64_t                   machine;
+    std::uint64_t                   state;      // 0 = nothing to resume
+};
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free, "records live in a shared mapping");
+
+inline std::size_t checkpoint_size(std::size_t capacity, std::size_t record_size) {
+    return sizeof(checkpoint_header) + capacity * record_size;
+}
+
+// FNV-1a of the type name, never 0
+template<typename T>
+std::uint64_t checkpoint_id() {
+    static const std::uint64_t id = [] {
+        std::uint64_t h = 14695981039346656037ull;
+        for (unsigned char c : util::type_name<T>()) {
+            h = (h ^ c) * 1099511628211ull;
+        }
+        return h ? h : 1;
+    }();
+    return id;
+}
+
+} // namespace detail
+
+// Appends the fields of a state to its checkpoint record. Throws
+// std::length_error when the record is too small.
+class checkpoint_writer {
+public:
+    checkpoint_writer(char* data, std::size_t capacity) : data(data), capacity(capacity), size(0) {}
+
+    template<typename T>
+    void write(const T& v) {
+        static_assert(std::is_trivially_copyable_v<T> && !std::is_pointer_v<T>, "write() copies the bytes of T, see write_string()");
+        put(&v, sizeof(v));
+    }
+
+    void write_string(std::string_view s) {
+        write(static_cast<std::uint32_t>(s.size()));
+        put(s.data(), s.size());
+    }
+
+    // kept as wall clock time, so it means the same moment after a restart
+    void write_deadline(std::chrono::steady_clock::time_point t) {
+        auto wall = std::chrono::system_clock::now() + std::chrono::duration_cast<std::chrono::system_clock::duration>(t - std::chrono::steady_clock::now());
+        write(static_cast<std::int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(wall.time_since_epoch()).count()));
+    }
+
+    std::size_t written() const noexcept {
+        return size;
+    }
+private:
+    void put(const void* p, std::size_t n) {
+        if (n > capacity - size) {
+            throw std::length_error("checkpoint record too small");
+        }
+        std::memcpy(data + size, p, n);
+        size += n;
+    }
+private:
+    char*           data;
+    std::size_t     capacity;
+    std::size_t     size;
+}; // class checkpoint_writer
+
+// Reads the fields back in the order they were written. Throws
+// std::out_of_range past the end of the record, the machine then starts over.
+class checkpoint_reader {
+public:
+    checkpoint_reader(const char* data, std::size_t size) : data(data), size(size), offset(0) {}
+
+    template<typename T>
+    T read() {
+        static_assert(std::is_trivially_copyable_v<T> && !std::is_pointer_v<T>, "read() copies the bytes of T, see read_string()");
+        T v;
+        get(&v, sizeof(v));
+        return v;
+    }
+
+    std::string read_string() {
+        // the length is checked before it is allocated, a torn record may say anything
+        auto n = read<std::uint32_t>();
+        check(n);
+        std::string s(n, '\0');
+        get(s.data(), s.size());
+        return s;
+    }
+
+    // a deadline written with write_deadline(), in the past if it expired meanwhile
+    std::chrono::steady_clock::time_point read_deadline() {
+        std::chrono::system_clock::time_point wall(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(read<std::int64_t>())));
+        return std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(wall - std::chrono::system_clock::now());
+    }
+private:
+    void check(std::size_t n) const {
+        if (n > size - offset) {
+            throw std::out_of_range("checkpoint record truncated");
+        }
+    }
+
+    void get(void* p, std::size_t n) {
+        check(n);
+        std::memcpy(p, data + offset, n);
+        offset += n;
+    }
+private:
+    const char*     data;
+    std::size_t     size;
+    std::size_t     offset;
+}; // class checkpoint_reader
+
+// How a state is written to a checkpoint and rebuilt from it, specialize for
+// every state a machine may resume in after a restart:
+//
+//   template<>
+//   struct state_checkpoint<backoff, context> {
+//       void save(const backoff& s, const context& ctx, checkpoint_writer& w) const;
+//       // the state's constructor arguments, like state_factory
+//       auto restore(checkpoint_reader& r, context& ctx) const;
+//   };
+//
+// With `using as = other_state;` the state is saved as another one and
+// resumed through that one's restore() (a connection resumes by connecting
+// again, say). States without save() are not recorded: a machine stopped in
+// one of them starts over from its start state.
+template<typename State, typename Context>
+struct state_checkpoint;
+
+namespace detail {
+
+template<typename State, typename Context, typename = void>
+struct checkpoint_saves : std::false_type {};
+
+template<typename State, typename Context>
+struct checkpoint_saves<State, Context, std::void_t<decltype(std::declval<const state_checkpoint<State, Context>&>().save(
+    std::declval<const State&>(), std::declval<const Context&>(), std::declval<checkpoint_writer&>()))>> : std::true_type {};
+
+template<typename State, typename Context, typename = void>
+struct checkpoint_restores : std::false_type {};
+
+template<typename State, typename Context>
+struct checkpoint_restores<State, Context, std::void_t<decltype(std::declval<const state_checkpoint<State, Context>&>().restore(
+    std::declval<checkpoint_reader&>(), std::declval<Context&>()))>> : std::true_type {};
+
+template<typename State, typename Context, typename = void>
+struct checkpoint_as {
+    using type = State;
+};
+
+template<typename State, typename Context>
+struct checkpoint_as<State, Context, std::void_t<typename state_checkpoint<State, Context>::as>> {
+    using type = typename state_checkpoint<State, Context>::as;
+};
+
+} // namespace detail
+
+// A file of fixed size records, one per machine, mapped into memory: machines
+// write their record on every transition with plain stores (see
+// state_machine::checkpoint()), the kernel writes the pages back, so the
+// records survive the process dying at any point. Reopening the file after a
+// restart keeps the records for the machines to resume from; a file of
+// another shape is started afresh. Written by one process at a time.
+class checkpoint_file {
+public:
+    checkpoint_file(const std::string& path, std::size_t capacity, std::size_t record_size = 128) :
+        name(path),
+        stride(round_up(record_size)),
+        size(detail::checkpoint_size(capacity, stride)),
+        base(nullptr),
+        stopped(false)
+    {
+        if (capacity == 0 || capacity > UINT32_MAX || record_size <= sizeof(detail::checkpoint_record) || stride > UINT32_MAX) {
+            throw std::invalid_argument("checkpoint_file capacity or record size out of range");
+        }
+
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw std::system_error(errno, std::system_category(), "open " + path);
+        }
+
+        struct stat st{};
+        ::fstat(fd, &st);
+        bool reused = st.st_size == static_cast<off_t>(size);
+        void* p = reused || ::ftruncate(fd, static_cast<off_t>(size)) == 0
+            ? ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+            : MAP_FAILED;
+        auto err = errno;
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            throw std::system_error(err, std::system_category(), "cannot map checkpoint " + path);
+        }
+        base = static_cast<char*>(p);
+
+        auto& h = header();
+        if (!reused || std::memcmp(h.magic, detail::checkpoint_header::magic_value, sizeof(h.magic)) != 0
+            || h.capacity != capacity || h.record_size != stride) {
+            std::memset(base, 0, size);
+            std::memcpy(h.magic, detail::checkpoint_header::magic_value, sizeof(h.magic));
+            h.capacity = static_cast<std::uint32_t>(capacity);
+            h.record_size = static_cast<std::uint32_t>(stride);
+        }
+    }
+
+    checkpoint_file(const checkpoint_file&) = delete;
+    checkpoint_file& operator=(const checkpoint_file&) = delete;
+
+    ~checkpoint_file() {
+        ::munmap(base, size);
+    }
+
+    std::size_t capacity() const noexcept {
+        return header().capacity;
+    }
+
+    // bytes a state may write into its record
+    std::size_t payload_size() const noexcept {
+        return stride - sizeof(detail::checkpoint_record);
+    }
+
+    // records holding a state to resume
+    std::size_t resumable() const noexcept {
+        std::size_t n = 0;
+        for (std::size_t i = 0; i < capacity(); ++i) {
+            auto& r = record(i);
+            n += r.seq.load(std::memory_order_acquire) % 2 == 0 && r.state != 0;
+        }
+        return n;
+    }
+
+    // Machines stop writing their records, which keep the states of this
+    // moment. Call before cancelling a fleet for a planned restart, otherwise
+    // the records end up saying the machines finished.
+    void freeze() noexcept {
+        stopped.store(true, std::memory_order_relaxed);
+    }
+
+    bool frozen() const noexcept {
+        return stopped.load(std::memory_order_relaxed);
+    }
+
+    // writes the pages out now; only needed to survive the host going down,
+    // the process dying loses nothing
+    void sync() {
+        if (::msync(base, size, MS_SYNC) != 0) {
+            throw std::system_error(errno, std::system_category(), "msync " + name);
+        }
+    }
+
+    const std::string& path() const noexcept {
+        return name;
+    }
+private:
+    friend class checkpoint_slot;
+
+    static std::size_t round_up(std::size_t n) {
+        constexpr auto a = alignof(detail::checkpoint_record);
+        return (n + a - 1) / a * a;
+    }
+
+    detail::checkpoint_header& header() const noexcept {
+        return *reinterpret_cast<detail::checkpoint_header*>(base);
+    }
+
+    detail::checkpoint_record& record(std::size_t i) const noexcept {
+        return *reinterpret_cast<detail::checkpoint_record*>(base + sizeof(detail::checkpoint_header) + i * stride);
+    }
+
+    char* payload(std::size_t i) const noexcept {
+        return reinterpret_cast<char*>(&record(i) + 1);
+    }
+private:
+    std::string             name;
+    std::size_t             stride;
+    std::size_t             size;
+    char*                   base;
+    std::atomic<bool>       stopped;
+}; // class checkpoint_file
+
+// A machine's record in a checkpoint_file.
+class checkpoint_slot {
+public:
+    struct saved {
+        std::uint64_t       state;
+        checkpoint_reader   reader;
+    };
+
+    checkpoint_slot() noexcept : file(nullptr), index(0) {}
+
+    checkpoint_slot(checkpoint_file& file, std::size_t index) : file(&file), index(index) {
+        if (index >= file.capacity()) {
+            throw std::out_of_range("no checkpoint record " + std::to_string(index) + " in " + file.path());
+        }
+    }
+
+    explicit operator bool() const noexcept {
+        return file != nullptr;
+    }
+
+    // the recorded state of a Machine, if there is one to resume
+    template<typename Machine>
+    std::optional<saved> load() const {
+        auto& r = file->record(index);
+        if (r.seq.load(std::memory_order_acquire) % 2 != 0 || r.state == 0
+            || r.machine != detail::checkpoint_id<Machine>() || r.size > file->payload_size()) {
+            return std::nullopt;
+        }
+        return saved{r.state, checkpoint_reader(file->payload(index), r.size)};
+    }
+
+    // records `s` as the state to resume, or nothing when it can not be saved
+    template<typename Machine, typename State, typename Context>
+    void save(const State& s, const Context& ctx) {
+        if (file->frozen()) {
+            return;
+        }
+
+        auto& r = begin();
+        r.machine = detail::checkpoint_id<Machine>();
+        r.state = 0;
+        r.size = 0;
+        if constexpr (detail::checkpoint_saves<State, Context>::value) {
+            checkpoint_writer w(file->payload(index), file->payload_size());
+            try {
+                state_checkpoint<State, Context>{}.save(s, ctx, w);
+                r.state = detail::checkpoint_id<typename detail::checkpoint_as<State, Context>::type>();
+                r.size = static_cast<std::uint32_t>(w.written());
+            } catch (const std::length_error&) {
+                AFSM_LOG_WARN("{} does not fit into a checkpoint record of {} bytes", util::lazy_type_name_of<State>(), file->payload_size());
+            }
+        }
+        end(r);
+    }
+
+    // nothing to resume, the machine finished
+    void clear() {
+        if (!file->frozen()) {
+            auto& r = begin();
+            r.state = 0;
+            end(r);
+        }
+    }
+private:
+    // odd while the record is written, also when a process that died
+    // writing it left it odd; only this slot writes the record
+    detail::checkpoint_record& begin() noexcept {
+        auto& r = file->record(index);
+        r.seq.store(r.seq.load(std::memory_order_relaxed) | 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return r;
+    }
+
+    static void end(detail::checkpoint_record& r) noexcept {
+        r.seq.store(r.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+private:
+    checkpoint_file*    file;
+    std::size_t         index;
+}; // class checkpoint_slot
+
+} // namespace afsm
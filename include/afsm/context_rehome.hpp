@@ -0,0 +1,24 @@
+#pragma once
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <functional>
+
+namespace afsm {
+
+// Points a machine's context at another io_service when the machine
+// migrates (state_machine::migrate()). The default assigns the context's
+// `io`, which therefore has to be a std::reference_wrapper<asio::io_service>;
+// specialize for contexts owning I/O objects of their own. Machines whose
+// context can not be re-homed can not migrate.
+template<typename Context>
+struct context_rehome {
+    template<typename C = Context>
+    auto operator()(C& ctx, asio::io_service& to) const -> decltype(void(ctx.io = std::ref(to))) {
+        ctx.io = std::ref(to);
+    }
+};
+
+} // namespace afsm
@@ -0,0 +1,57 @@
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+namespace afsm {
+namespace detail {
+
+// Fixed size byte buffer on the heap whose readable and writable regions are
+// contiguous. Consumed space is reclaimed by compact(): an empty buffer starts
+// over at the front, otherwise the unconsumed bytes (normally an incomplete
+// frame) are moved to the front once less than half of the buffer is left to
+// write into. Only compact while no read into write_ptr() is outstanding and
+// no pointer into the readable region is in use.
+class compacting_buffer {
+public:
+    explicit compacting_buffer(std::size_t capacity) :
+        data(new char[capacity ? capacity : 1]),
+        cap(capacity ? capacity : 1),
+        rd(0),
+        wr(0)
+    {}
+
+    compacting_buffer(const compacting_buffer&) = delete;
+    compacting_buffer& operator=(const compacting_buffer&) = delete;
+
+    std::size_t capacity() const noexcept { return cap; }
+    std::size_t readable() const noexcept { return wr - rd; }
+    std::size_t writable() const noexcept { return cap - wr; }
+
+    const char* read_ptr() const noexcept { return data.get() + rd; }
+    char* write_ptr() noexcept { return data.get() + wr; }
+
+    void commit(std::size_t n) noexcept { wr += n; }
+
+    void consume(std::size_t n) noexcept { rd += n; }
+
+    void compact() noexcept {
+        if (rd == wr) {
+            rd = wr = 0;
+        } else if (rd > 0 && writable() < cap / 2) {
+            std::memmove(data.get(), data.get() + rd, wr - rd);
+            wr -= rd;
+            rd = 0;
+        }
+    }
+private:
+    std::unique_ptr<char[]>     data;
+    std::size_t                 cap;
+    std::size_t                 rd;
+    std::size_t                 wr;
+}; // class compacting_buffer
+
+} // namespace detail
+} // namespace afsm
@@ -0,0 +1,17 @@
+#pragma once
+
+// std
+#include <type_traits>
+#include <variant>
+
+namespace afsm {
+namespace detail {
+
+template<typename T>
+struct is_variant : std::false_type {};
+
+template<typename ...Args>
+struct is_variant<std::variant<Args...>> : std::true_type {};
+
+} // namespace detail
+} // namespace afsm
@@ -0,0 +1,111 @@
+#pragma once
+
+// thirdparty
+#include <fmt/format.h>
+
+// std
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <new>
+
+namespace afsm {
+namespace detail {
+
+// lines buffered per logging thread, about 230 bytes each; the backend drains
+// the rings every millisecond, lines beyond a full ring are counted as dropped
+#ifndef AFSM_LOG_RING_SIZE
+#define AFSM_LOG_RING_SIZE 1024
+#endif
+
+// one pending log line: the format string, the captured arguments and a
+// function which knows how to format (and destroy) them on the backend thread
+struct log_record {
+    static constexpr std::size_t payload_size = 192;
+    using format_fn = void (*)(log_record&, fmt::memory_buffer&);
+
+    std::chrono::system_clock::time_point               ts;
+    int                                                 lvl;
+    const char*                                         fmt;
+    format_fn                                           format;
+    alignas(std::max_align_t) unsigned char             payload[payload_size];
+};
+
+// single producer single consumer ring; the producer is the thread owning the
+// ring, the consumer is the logging backend
+class log_ring {
+public:
+    log_ring() :
+        slots(new log_record[AFSM_LOG_RING_SIZE]),
+        head(0),
+        tail(0),
+        dropped(0),
+        retired(false)
+    {
+        static_assert((AFSM_LOG_RING_SIZE & (AFSM_LOG_RING_SIZE - 1)) == 0, "AFSM_LOG_RING_SIZE must be a power of two");
+    }
+
+    log_ring(const log_ring&) = delete;
+    log_ring& operator=(const log_ring&) = delete;
+
+    ~log_ring() {
+        while (auto* r = front()) {
+            fmt::memory_buffer discard;
+            r->format(*r, discard);
+            pop();
+        }
+    }
+
+    // producer side: returns nullptr when the ring is full
+    log_record* claim() noexcept {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == AFSM_LOG_RING_SIZE) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &slots[h & (AFSM_LOG_RING_SIZE - 1)];
+    }
+
+    void publish() noexcept {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // consumer side
+    log_record* front() noexcept {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &slots[t & (AFSM_LOG_RING_SIZE - 1)];
+    }
+
+    void pop() noexcept {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool empty() const noexcept {
+        return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+    }
+
+    std::size_t take_dropped() noexcept {
+        return dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+    void retire() noexcept {
+        retired.store(true, std::memory_order_release);
+    }
+
+    bool is_retired() const noexcept {
+        return retired.load(std::memory_order_acquire);
+    }
+private:
+    std::unique_ptr<log_record[]>               slots;
+    alignas(64) std::atomic<std::size_t>        head;
+    alignas(64) std::atomic<std::size_t>        tail;
+    std::atomic<std::size_t>                    dropped;
+    std::atomic<bool>                           retired;
+}; // class log_ring
+
+} // namespace detail
+} // namespace afsm
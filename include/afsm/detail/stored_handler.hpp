@@ -0,0 +1,204 @@
+#pragma once
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// per-operation cancellation slots exist from asio 1.19 on
+#if defined(ASIO_VERSION) && ASIO_VERSION >= 101900
+#define AFSM_ASIO_CANCELLATION 1
+#else
+#define AFSM_ASIO_CANCELLATION 0
+#endif
+
+namespace afsm {
+namespace detail {
+
+// The completion handler of a pending async_wait(), type erased without
+// std::function: kept in place when small (the handlers machines pass to
+// their states are), otherwise in memory from the handler's associated
+// allocator, which is released before the handler runs. A handler with an
+// associated executor is dispatched there and keeps work on it meanwhile;
+// any other one is invoked right away, from the completing machine.
+template<typename Arg>
+class stored_handler {
+public:
+    stored_handler() noexcept : ops(nullptr) {}
+
+    template<typename Handler, typename = std::enable_if_t<!std::is_same_v<std::decay_t<Handler>, stored_handler>>>
+    explicit stored_handler(Handler&& handler) : ops(nullptr) {
+        using B = bound<std::decay_t<Handler>>;
+        if constexpr (fits_inline<B>) {
+            new (&storage) B(std::forward<Handler>(handler));
+        } else {
+            auto alloc = allocator_of<B>(handler);
+            auto* p = std::allocator_traits<decltype(alloc)>::allocate(alloc, 1);
+            try {
+                new (p) B(std::forward<Handler>(handler));
+            } catch (...) {
+                std::allocator_traits<decltype(alloc)>::deallocate(alloc, p, 1);
+                throw;
+            }
+            new (&storage) B*(p);
+        }
+        ops = &operations_of<B>;
+    }
+
+    stored_handler(stored_handler&& other) noexcept : ops(std::exchange(other.ops, nullptr)) {
+        if (ops) {
+            ops->move(storage, other.storage);
+        }
+    }
+
+    stored_handler& operator=(stored_handler&& other) noexcept {
+        if (this != &other) {
+            reset();
+            ops = std::exchange(other.ops, nullptr);
+            if (ops) {
+                ops->move(storage, other.storage);
+            }
+        }
+        return *this;
+    }
+
+    stored_handler(const stored_handler&) = delete;
+    stored_handler& operator=(const stored_handler&) = delete;
+
+    ~stored_handler() {
+        reset();
+    }
+
+    explicit operator bool() const noexcept {
+        return ops != nullptr;
+    }
+
+    // invokes the handler once, the stored_handler is empty afterwards
+    void operator()(Arg arg) {
+        std::exchange(ops, nullptr)->complete(storage, std::move(arg));
+    }
+
+    void reset() noexcept {
+        if (ops) {
+            std::exchange(ops, nullptr)->destroy(storage);
+        }
+    }
+private:
+    static constexpr std::size_t inline_size = 6 * sizeof(void*);
+    using buffer = std::aligned_storage_t<inline_size, alignof(std::max_align_t)>;
+
+    template<typename Handler>
+    class bound {
+    public:
+        using executor = asio::associated_executor_t<Handler>;
+        static constexpr bool dispatched = !std::is_same_v<executor, asio::system_executor>;
+
+        explicit bound(Handler handler) :
+            handler(std::move(handler)),
+            work(make_work(this->handler))
+        {}
+
+        // clears the cancellation slot, then runs the handler where it belongs
+        void complete(Arg arg) {
+#if AFSM_ASIO_CANCELLATION
+            asio::get_associated_cancellation_slot(handler).clear();
+#endif
+            if constexpr (dispatched) {
+                auto ex = work.get_executor();
+                asio::dispatch(ex, [handler = std::move(handler), arg = std::move(arg), work = std::move(work)]() mutable {
+                    std::move(handler)(std::move(arg));
+                });
+            } else {
+                std::move(handler)(std::move(arg));
+            }
+        }
+
+        Handler handler;
+    private:
+        static auto make_work(const Handler& handler) {
+            if constexpr (dispatched) {
+                return asio::make_work_guard(asio::get_associated_executor(handler));
+            } else {
+                return nullptr;
+            }
+        }
+    private:
+        std::conditional_t<dispatched, asio::executor_work_guard<executor>, std::nullptr_t> work;
+    };
+
+    template<typename B>
+    static constexpr bool fits_inline = sizeof(B) <= inline_size && std::is_nothrow_move_constructible_v<B>;
+
+    template<typename B, typename Handler>
+    static auto allocator_of(const Handler& handler) {
+        using alloc = asio::associated_allocator_t<Handler>;
+        return typename std::allocator_traits<alloc>::template rebind_alloc<B>(asio::get_associated_allocator(handler));
+    }
+
+    struct operations {
+        void (*complete)(buffer&, Arg);
+        void (*destroy)(buffer&) noexcept;
+        void (*move)(buffer& to, buffer& from) noexcept;
+    };
+
+    template<typename B>
+    static B* heap_ptr(buffer& b) noexcept {
+        return *std::launder(reinterpret_cast<B**>(&b));
+    }
+
+    template<typename B>
+    static void release(B* p) noexcept {
+        auto alloc = allocator_of<B>(p->handler);
+        p->~B();
+        std::allocator_traits<decltype(alloc)>::deallocate(alloc, p, 1);
+    }
+
+    template<typename B>
+    static void complete_impl(buffer& b, Arg arg) {
+        if constexpr (fits_inline<B>) {
+            auto& stored = *std::launder(reinterpret_cast<B*>(&b));
+            B local(std::move(stored));
+            stored.~B();
+            local.complete(std::move(arg));
+        } else {
+            auto* p = heap_ptr<B>(b);
+            B local(std::move(*p));
+            release(p);
+            local.complete(std::move(arg));
+        }
+    }
+
+    template<typename B>
+    static void destroy_impl(buffer& b) noexcept {
+        if constexpr (fits_inline<B>) {
+            std::launder(reinterpret_cast<B*>(&b))->~B();
+        } else {
+            release(heap_ptr<B>(b));
+        }
+    }
+
+    template<typename B>
+    static void move_impl(buffer& to, buffer& from) noexcept {
+        if constexpr (fits_inline<B>) {
+            auto& src = *std::launder(reinterpret_cast<B*>(&from));
+            new (&to) B(std::move(src));
+            src.~B();
+        } else {
+            new (&to) B*(heap_ptr<B>(from));
+        }
+    }
+
+    template<typename B>
+    static inline const operations operations_of = {&complete_impl<B>, &destroy_impl<B>, &move_impl<B>};
+private:
+    buffer              storage;
+    const operations*   ops;
+}; // class stored_handler
+
+} // namespace detail
+} // namespace afsm
@@ -0,0 +1,48 @@
+#pragma once
+
+// std
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace afsm {
+namespace detail {
+
+// move-only nullary callable, unlike std::function it accepts move-only
+// handlers
+class task {
+public:
+    task() = default;
+
+    template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, task>>>
+    task(F&& f) : impl(std::make_unique<model<std::decay_t<F>>>(std::forward<F>(f))) {}
+
+    task(task&&) noexcept = default;
+    task& operator=(task&&) noexcept = default;
+
+    void operator()() {
+        impl->call();
+    }
+
+    explicit operator bool() const noexcept {
+        return static_cast<bool>(impl);
+    }
+private:
+    struct concept_t {
+        virtual ~concept_t() = default;
+        virtual void call() = 0;
+    };
+
+    template<typename F>
+    struct model : concept_t {
+        model(F&& f) : f(std::move(f)) {}
+        model(const F& f) : f(f) {}
+        void call() override { f(); }
+        F f;
+    };
+private:
+    std::unique_ptr<concept_t> impl;
+}; // class task
+
+} // namespace detail
+} // namespace afsm
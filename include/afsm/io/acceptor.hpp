@@ -0,0 +1,190 @@
+#pragma once
+
+// ours
+#include "session_pool.hpp"
+#include <afsm/state.hpp>
+#include <afsm/state_factory.hpp>
+#include <afsm/state_machine.hpp>
+#include <afsm/transition.hpp>
+#include <afsm/transitions.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <system_error>
+
+namespace afsm {
+namespace io {
+
+class accept_failed {
+public:
+    accept_failed(const std::error_code& ec) noexcept : ec(ec) {}
+    std::error_code ec;
+};
+
+class accept_stopped {};
+class accept_retry {};
+
+struct acceptor_options {
+    std::size_t                 concurrent_accepts = 16;
+    int                         backlog = asio::socket_base::max_listen_connections;
+    std::chrono::milliseconds   error_backoff = std::chrono::milliseconds(100);
+};
+
+// Keeps `concurrent_accepts` accepts outstanding, each for a slot reserved
+// in the session pool and directly into the io_service of that slot's shard.
+// Accepting pauses while the pool is full.
+template<typename Session>
+class accepting : public state<accept_failed, accept_stopped> {
+public:
+    accepting(asio::io_service& io, asio::ip::tcp::acceptor& acceptor, session_pool<Session>& pool, const acceptor_options& opts) :
+        state(io),
+        acceptor(acceptor),
+        pool(pool),
+        opts(opts)
+    {}
+
+    virtual void on_enter() override {
+        for (std::size_t i = 0; i < opts.concurrent_accepts; ++i) {
+            start_accept();
+        }
+    }
+
+    virtual void cancel() override {
+        complete<accept_stopped>();
+        acceptor.cancel();
+        pool.notify(this);
+    }
+private:
+    void start_accept() {
+        if (!active()) {
+            return;
+        }
+
+        auto s = pool.reserve(io, track([this] { start_accept(); }), this);
+        if (!s) {
+            return;
+        }
+
+        acceptor.async_accept(pool.shard(*s), track([this, s = *s](const std::error_code& ec, asio::ip::tcp::socket sock) {
+            if (ec) {
+                pool.release(s);
+                if (ec != asio::error::operation_aborted) {
+                    complete<accept_failed>(ec);
+                }
+                return;
+            }
+
+            pool.spawn(s, std::move(sock));
+            start_accept();
+        }));
+    }
+private:
+    asio::ip::tcp::acceptor&    acceptor;
+    session_pool<Session>&      pool;
+    acceptor_options            opts;
+}; // class accepting
+
+// pause after an accept error (e.g. out of file descriptors)
+class accept_backoff : public state<accept_retry, accept_stopped> {
+public:
+    accept_backoff(asio::io_service& io, std::chrono::milliseconds delay) :
+        state(io),
+        timer(io)
+    {
+        timer.expires_from_now(delay);
+    }
+
+    virtual void on_enter() override {
+        timer.async_wait(track([this](const std::error_code& ec) {
+            ec ? complete<accept_stopped>() : complete<accept_retry>();
+        }));
+    }
+
+    virtual void cancel() override {
+        complete<accept_stopped>();
+        timer.cancel();
+    }
+private:
+    asio::steady_timer timer;
+}; // class accept_backoff
+
+struct server_stopped {
+    template<typename ...Args>
+    server_stopped(Args&& ...) {}
+};
+
+template<typename Session>
+struct server_context {
+    server_context(asio::io_service& io, const asio::ip::tcp::endpoint& ep, session_pool<Session>& pool, acceptor_options opts = {}) :
+        io(io),
+        acceptor(io),
+        pool(pool),
+        opts(opts)
+    {
+        acceptor.open(ep.protocol());
+        acceptor.set_option(asio::socket_base::reuse_address(true));
+        acceptor.bind(ep);
+        acceptor.listen(opts.backlog);
+    }
+
+    asio::io_service&           io;
+    asio::ip::tcp::acceptor     acceptor;
+    session_pool<Session>&      pool;
+    acceptor_options            opts;
+};
+
+} // namespace io
+
+template<typename Event, typename Session>
+struct state_factory<io::accepting<Session>, Event, io::server_context<Session>> {
+    auto operator()(const Event&, io::server_context<Session>& ctx) const {
+        return std::make_tuple(std::ref(ctx.io), std::ref(ctx.acceptor), std::ref(ctx.pool), std::cref(ctx.opts));
+    }
+};
+
+template<typename Event, typename Session>
+struct state_factory<io::accept_backoff, Event, io::server_context<Session>> {
+    auto operator()(const Event&, io::server_context<Session>& ctx) const {
+        return std::make_tuple(std::ref(ctx.io), ctx.opts.error_backoff);
+    }
+};
+
+template<typename Event, typename Session>
+struct result_factory<Event, io::server_context<Session>> {
+    std::error_code operator()(const Event&, io::server_context<Session>&) const {
+        return {};
+    }
+};
+
+namespace io {
+
+// Listening server: accepts into a session_pool until cancelled, then
+// completes. Sessions keep running, session_pool::cancel_all() stops them.
+//
+//   afsm::io::server<session> srv(io);
+//   srv.async_wait(handler, endpoint, pool, opts);
+template<typename Session>
+struct server_traits {
+    using start_state = accepting<Session>;
+    using end_state = server_stopped;
+    using result = std::error_code;
+    using context = server_context<Session>;
+    using transitions = afsm::transitions<
+        afsm::transition<accepting<Session>, accept_failed, accept_backoff>,
+        afsm::transition<accepting<Session>, accept_stopped, server_stopped>,
+
+        afsm::transition<accept_backoff, accept_retry, accepting<Session>>,
+        afsm::transition<accept_backoff, accept_stopped, server_stopped>
+    >;
+};
+
+template<typename Session>
+using server = state_machine<server_traits<Session>>;
+
+} // namespace io
+} // namespace afsm
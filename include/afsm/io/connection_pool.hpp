@@ -0,0 +1,583 @@
+#pragma once
+
+// ours
+#include <afsm/result_factory.hpp>
+#include <afsm/state.hpp>
+#include <afsm/state_factory.hpp>
+#include <afsm/state_machine.hpp>
+#include <afsm/transition.hpp>
+#include <afsm/transitions.hpp>
+#include <afsm/util/backoff.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace afsm {
+namespace io {
+
+class connection_pool;
+
+namespace detail {
+class parked;
+} // namespace detail
+
+// An established connection taken from a connection_pool. Recycle it once
+// the exchange on it is complete and the connection is reusable; otherwise
+// (or by just dropping the lease) it is closed and the pool dials a
+// replacement. The pool must outlive its leases.
+class lease {
+public:
+    lease() noexcept : pool(nullptr), slot(0) {}
+
+    lease(lease&& other) noexcept :
+        pool(std::exchange(other.pool, nullptr)),
+        slot(other.slot),
+        sock(std::move(other.sock))
+    {
+        other.sock.reset();
+    }
+
+    lease& operator=(lease&& other) noexcept {
+        if (this != &other) {
+            discard();
+            pool = std::exchange(other.pool, nullptr);
+            slot = other.slot;
+            sock = std::move(other.sock);
+            other.sock.reset();
+        }
+        return *this;
+    }
+
+    ~lease() {
+        discard();
+    }
+
+    asio::ip::tcp::socket& socket() {
+        return *sock;
+    }
+
+    explicit operator bool() const noexcept {
+        return pool != nullptr;
+    }
+
+    // hands the connection back for the next lessee
+    void recycle();
+
+    // closes the connection, the pool dials a new one
+    void discard();
+private:
+    friend class detail::parked;
+
+    lease(connection_pool& pool, std::size_t slot, asio::ip::tcp::socket&& s) :
+        pool(&pool),
+        slot(slot),
+        sock(std::move(s))
+    {}
+private:
+    connection_pool*                        pool;
+    std::size_t                             slot;
+    std::optional<asio::ip::tcp::socket>    sock;
+}; // class lease
+
+namespace detail {
+
+// Every connection of a pool is kept by a machine of its own:
+//
+//   dialing --dialed--> parked --lent_out--> lent --returned--> parked
+//      ^                  |                   |
+//      +--connection_lost-+-------------------+
+//   dialing --dial_failed--> redial_wait --redial--> dialing
+class dialed {};
+class dial_failed {
+public:
+    dial_failed(const std::error_code& ec) noexcept : ec(ec) {}
+    std::error_code ec;
+};
+class redial {};
+class lent_out {};
+class returned {};
+class connection_lost {};
+class pool_stopped {};
+
+struct member_context {
+    member_context(asio::io_service& io, connection_pool& pool, std::size_t slot) :
+        io(io),
+        pool(pool),
+        slot(slot),
+        sock(io)
+    {}
+
+    asio::io_service&                   io;
+    connection_pool&                    pool;
+    std::size_t                         slot;
+    asio::ip::tcp::socket               sock;
+    util::decorrelated_jitter           delay;
+};
+
+} // namespace detail
+} // namespace io
+
+// every state of a pool member is built from (io, member_context&)
+template<typename State, typename Event>
+struct state_factory<State, Event, io::detail::member_context> {
+    auto operator()(const Event&, io::detail::member_context& ctx) const {
+        return std::make_tuple(std::ref(ctx.io), std::ref(ctx));
+    }
+};
+
+template<typename Event>
+struct result_factory<Event, io::detail::member_context> {
+    std::error_code operator()(const Event&, io::detail::member_context&) const {
+        return {};
+    }
+};
+
+namespace io {
+namespace detail {
+
+class dialing : public state<dialed, dial_failed, pool_stopped> {
+public:
+    dialing(asio::io_service& io, member_context& ctx) : state(io), ctx(ctx) {}
+
+    virtual void on_enter() override;
+
+    virtual void cancel() override {
+        complete<pool_stopped>();
+        // lent out connections are no longer ours to cancel
+        if (ctx.sock.is_open()) {
+            ctx.sock.cancel();
+        }
+    }
+private:
+    member_context& ctx;
+};
+
+class redial_wait : public state<redial, pool_stopped> {
+public:
+    redial_wait(asio::io_service& io, member_context& ctx) :
+        state(io),
+        timer(io)
+    {
+        timer.expires_from_now(ctx.delay.next());
+    }
+
+    virtual void on_enter() override {
+        timer.async_wait(track([this](const std::error_code& ec) {
+            ec ? complete<pool_stopped>() : complete<redial>();
+        }));
+    }
+
+    virtual void cancel() override {
+        complete<pool_stopped>();
+        timer.cancel();
+    }
+private:
+    asio::steady_timer timer;
+};
+
+// idle in the pool; the peer closing the connection (or sending anything
+// unsolicited) makes the socket readable, then it is replaced
+class parked : public state<lent_out, connection_lost, pool_stopped> {
+public:
+    parked(asio::io_service& io, member_context& ctx) : state(io), ctx(ctx) {
+        ctx.delay.reset();
+    }
+
+    ~parked() override;
+
+    virtual void on_enter() override;
+
+    virtual void cancel() override {
+        complete<pool_stopped>();
+        // lent out connections are no longer ours to cancel
+        if (ctx.sock.is_open()) {
+            ctx.sock.cancel();
+        }
+    }
+
+    // moves the connection into a lease
+    lease lend();
+private:
+    member_context& ctx;
+};
+
+// waits for the lease to come back
+class lent : public state<returned, connection_lost, pool_stopped> {
+public:
+    lent(asio::io_service& io, member_context& ctx) : state(io), ctx(ctx) {}
+
+    ~lent() override;
+
+    virtual void on_enter() override;
+
+    virtual void cancel() override {
+        complete<pool_stopped>();
+        wake();
+    }
+
+    void give_back(asio::ip::tcp::socket&& sock) {
+        ctx.sock = std::move(sock);
+        complete<returned>();
+        wake();
+    }
+
+    void lost() {
+        complete<connection_lost>();
+        wake();
+    }
+private:
+    void wake() {
+        if (pending) {
+            std::exchange(pending, nullptr)();
+        }
+    }
+private:
+    member_context&         ctx;
+    std::function<void()>   pending;    // keeps the state waiting
+};
+
+struct member_closed {
+    template<typename ...Args>
+    member_closed(Args&& ...) {}
+};
+
+struct member_traits {
+    using start_state = dialing;
+    using end_state = member_closed;
+    using context = member_context;
+    using result = std::error_code;
+    using transitions = afsm::transitions<
+        afsm::transition<dialing, dialed, parked>,
+        afsm::transition<dialing, dial_failed, redial_wait>,
+        afsm::transition<dialing, pool_stopped, member_closed>,
+
+        afsm::transition<redial_wait, redial, dialing>,
+        afsm::transition<redial_wait, pool_stopped, member_closed>,
+
+        afsm::transition<parked, lent_out, lent>,
+        afsm::transition<parked, connection_lost, dialing>,
+        afsm::transition<parked, pool_stopped, member_closed>,
+
+        afsm::transition<lent, returned, parked>,
+        afsm::transition<lent, connection_lost, dialing>,
+        afsm::transition<lent, pool_stopped, member_closed>
+    >;
+};
+
+using member = state_machine<member_traits>;
+
+} // namespace detail
+
+struct pool_options {
+    std::size_t connections = 4;
+};
+
+// Warm connections to one endpoint, each maintained by a small machine that
+// dials, parks the connection, lends it out and takes it back, redialing with
+// jittered backoff whenever a connection is lost or discarded. Leases are
+// handed out FIFO as connections become idle. Everything runs on the pool's
+// io_service, lessees must use the same one.
+class connection_pool {
+public:
+    using ticket = std::uint64_t;
+    using lease_handler = std::function<void(const std::error_code&, lease)>;
+
+    connection_pool(asio::io_service& io, const asio::ip::tcp::endpoint& ep, pool_options opts = {}) :
+        io(io),
+        ep(ep),
+        lent_slots(opts.connections),
+        next_ticket(1),
+        stopped(false)
+    {
+        for (std::size_t i = 0; i < opts.connections; ++i) {
+            members.emplace_back(io);
+            members.back().async_wait([](const std::error_code&) {}, std::ref(*this), i);
+        }
+    }
+
+    connection_pool(const connection_pool&) = delete;
+    connection_pool& operator=(const connection_pool&) = delete;
+
+    // handler: void(const std::error_code&, lease), always posted; fails with
+    // operation_aborted once the pool is stopped
+    ticket async_lease(lease_handler handler) {
+        auto t = next_ticket++;
+        if (stopped) {
+            asio::post(io, [handler = std::move(handler)] { handler(make_error_code(asio::error::operation_aborted), lease()); });
+        } else if (!idle.empty()) {
+            auto* p = idle.front();
+            idle.pop_front();
+            deliver(std::move(handler), p->lend());
+        } else {
+            waiters.emplace_back(t, std::move(handler));
+        }
+        return t;
+    }
+
+    void cancel(ticket t) {
+        auto it = std::find_if(waiters.begin(), waiters.end(), [t](auto& w) { return w.first == t; });
+        if (it != waiters.end()) {
+            auto handler = std::move(it->second);
+            waiters.erase(it);
+            asio::post(io, [handler = std::move(handler)] { handler(make_error_code(asio::error::operation_aborted), lease()); });
+        }
+    }
+
+    // closes every connection and fails all waiting lessees
+    void stop() {
+        stopped = true;
+        for (auto& m : members) {
+            m.cancel();
+        }
+        for (auto& w : std::exchange(waiters, {})) {
+            asio::post(io, [handler = std::move(w.second)] { handler(make_error_code(asio::error::operation_aborted), lease()); });
+        }
+    }
+
+    const asio::ip::tcp::endpoint& endpoint() const noexcept {
+        return ep;
+    }
+
+    std::size_t size() const noexcept {
+        return members.size();
+    }
+
+    // connections parked right now
+    std::size_t available() const noexcept {
+        return idle.size();
+    }
+private:
+    friend class lease;
+    friend class detail::dialing;
+    friend class detail::parked;
+    friend class detail::lent;
+
+    void deliver(lease_handler handler, lease l) {
+        asio::post(io, [handler = std::move(handler), l = std::move(l)]() mutable {
+            handler(std::error_code(), std::move(l));
+        });
+    }
+
+    // a connection became idle: straight to the oldest waiter, or parked
+    void park(detail::parked* p) {
+        if (!waiters.empty()) {
+            auto handler = std::move(waiters.front().second);
+            waiters.pop_front();
+            return deliver(std::move(handler), p->lend());
+        }
+        idle.push_back(p);
+    }
+
+    void unpark(detail::parked* p) {
+        idle.erase(std::remove(idle.begin(), idle.end(), p), idle.end());
+    }
+
+    // a lease may come back before its member got to the lent state
+    void give_back(std::size_t slot, asio::ip::tcp::socket&& sock) {
+        auto& s = lent_slots[slot];
+        if (s.state) {
+            s.state->give_back(std::move(sock));
+        } else {
+            s.early.emplace(std::move(sock));
+        }
+    }
+
+    void lost(std::size_t slot) {
+        auto& s = lent_slots[slot];
+        if (s.state) {
+            s.state->lost();
+        } else {
+            s.lost_early = true;
+        }
+    }
+
+    void lent_entered(std::size_t slot, detail::lent* l) {
+        auto& s = lent_slots[slot];
+        s.state = l;
+        if (s.early) {
+            auto sock = std::move(*s.early);
+            s.early.reset();
+            l->give_back(std::move(sock));
+        } else if (std::exchange(s.lost_early, false)) {
+            l->lost();
+        }
+    }
+
+    void lent_left(std::size_t slot, detail::lent* l) {
+        if (lent_slots[slot].state == l) {
+            lent_slots[slot].state = nullptr;
+        }
+    }
+private:
+    struct lent_slot {
+        detail::lent*                           state = nullptr;
+        std::optional<asio::ip::tcp::socket>    early;
+        bool                                    lost_early = false;
+    };
+private:
+    asio::io_service&                                   io;
+    asio::ip::tcp::endpoint                             ep;
+    std::deque<detail::parked*>                         idle;
+    std::vector<lent_slot>                              lent_slots;
+    std::deque<std::pair<ticket, lease_handler>>        waiters;
+    ticket                                              next_ticket;
+    bool                                                stopped;
+    // last, its states unregister from the members above when destroyed
+    std::deque<detail::member>                          members;
+}; // class connection_pool
+
+// One connection_pool per endpoint and io_service. The pools are stopped and
+// destroyed when the io_service shuts down, while the services their sockets
+// belong to are still there; a pool taken from here must not be used after.
+class connection_pools : public asio::io_service::service {
+public:
+    static inline asio::io_service::id id;
+
+    explicit connection_pools(asio::io_service& io) : asio::io_service::service(io), io(io) {}
+
+    // the pool for `ep`, created with `opts` on first use
+    connection_pool& get(const asio::ip::tcp::endpoint& ep, pool_options opts = {}) {
+        auto it = pools.find(ep);
+        if (it == pools.end()) {
+            it = pools.emplace(ep, std::make_unique<connection_pool>(io, ep, opts)).first;
+        }
+        return *it->second;
+    }
+private:
+    void shutdown() override {
+        for (auto& p : pools) {
+            p.second->stop();
+        }
+        pools.clear();
+    }
+private:
+    asio::io_service&                                                       io;
+    std::map<asio::ip::tcp::endpoint, std::unique_ptr<connection_pool>>     pools;
+}; // class connection_pools
+
+inline void lease::recycle() {
+    if (pool) {
+        std::exchange(pool, nullptr)->give_back(slot, std::move(*sock));
+        sock.reset();
+    }
+}
+
+inline void lease::discard() {
+    if (pool) {
+        sock.reset();
+        std::exchange(pool, nullptr)->lost(slot);
+    }
+}
+
+namespace detail {
+
+inline void dialing::on_enter() {
+    // a connection that was lost is still open
+    if (ctx.sock.is_open()) {
+        ctx.sock.close();
+    }
+    ctx.sock.async_connect(ctx.pool.endpoint(), track([this](const std::error_code& ec) {
+        if (ec) {
+            return ec == asio::error::operation_aborted ? complete<pool_stopped>() : complete<dial_failed>(ec);
+        }
+        complete<dialed>();
+    }));
+}
+
+inline parked::~parked() {
+    ctx.pool.unpark(this);
+}
+
+inline void parked::on_enter() {
+    ctx.sock.async_wait(asio::socket_base::wait_read, track([this](const std::error_code& ec) {
+        if (ec != asio::error::operation_aborted) {
+            complete<connection_lost>();
+        }
+    }));
+    ctx.pool.park(this);
+}
+
+inline lease parked::lend() {
+    complete<lent_out>();
+    return lease(ctx.pool, ctx.slot, std::move(ctx.sock));
+}
+
+inline lent::~lent() {
+    ctx.pool.lent_left(ctx.slot, this);
+}
+
+inline void lent::on_enter() {
+    pending = track([] {});
+    ctx.pool.lent_entered(ctx.slot, this);
+}
+
+} // namespace detail
+
+class leased {
+public:
+    leased(lease& l) noexcept : l(l) {}
+    std::reference_wrapper<lease> l;
+
+    operator lease&() const {
+        return l.get();
+    }
+};
+
+class lease_failed {
+public:
+    lease_failed(const std::error_code& ec) noexcept : ec(ec) {}
+    std::error_code ec;
+};
+
+class lease_stopped {};
+
+// Takes a connection from a pool, the next state receives it with the
+// leased event (like connected/online). A lease arriving after the state
+// was cancelled goes straight back to the pool.
+class leasing : public state<leased, lease_failed, lease_stopped> {
+public:
+    leasing(asio::io_service& io, connection_pool& pool) :
+        state(io),
+        pool(pool),
+        ticket(0)
+    {}
+
+    virtual void on_enter() override {
+        ticket = pool.async_lease(track([this](const std::error_code& ec, lease l) {
+            if (!active()) {
+                return l.recycle();
+            }
+            if (ec) {
+                return ec == asio::error::operation_aborted ? complete<lease_stopped>() : complete<lease_failed>(ec);
+            }
+
+            held = std::move(l);
+            complete<leased>(held);
+        }));
+    }
+
+    virtual void cancel() override {
+        complete<lease_stopped>();
+        pool.cancel(ticket);
+    }
+private:
+    connection_pool&            pool;
+    connection_pool::ticket     ticket;
+    lease                       held;
+}; // class leasing
+
+} // namespace io
+} // namespace afsm
@@ -0,0 +1,316 @@
+#pragma once
+
+// ours
+#include <afsm/state.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+// system
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace afsm {
+namespace io {
+namespace detail {
+
+// Preallocated storage for a batch of datagrams: `count` slots of `size`
+// bytes in one allocation, plus the headers recvmmsg/sendmmsg work on.
+// Peer addresses are read and written in place in asio endpoints.
+class datagram_slab {
+public:
+    datagram_slab(std::size_t count, std::size_t size) :
+        bytes(new char[count * size]),
+        slot_size(size),
+        headers(count),
+        iovs(count),
+        peers(count)
+    {
+        for (std::size_t i = 0; i < count; ++i) {
+            iovs[i].iov_base = bytes.get() + i * size;
+            iovs[i].iov_len = size;
+            headers[i].msg_hdr.msg_iov = &iovs[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+            headers[i].msg_hdr.msg_name = peers[i].data();
+        }
+    }
+
+    datagram_slab(const datagram_slab&) = delete;
+    datagram_slab& operator=(const datagram_slab&) = delete;
+
+    // resets slot headers [0, n) for receiving into the whole slot
+    void prepare_receive(std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            iovs[i].iov_len = slot_size;
+            headers[i].msg_hdr.msg_namelen = static_cast<socklen_t>(peers[i].capacity());
+            headers[i].msg_hdr.msg_flags = 0;
+            headers[i].msg_len = 0;
+        }
+    }
+
+    // adopts the address lengths the kernel filled in for slots [0, n)
+    void finish_receive(std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            peers[i].resize(headers[i].msg_hdr.msg_namelen);
+        }
+    }
+
+    // copies a datagram into slot `i` for sending
+    void prepare_send(std::size_t i, std::string_view payload, const asio::ip::udp::endpoint& to) {
+        std::memcpy(iovs[i].iov_base, payload.data(), payload.size());
+        iovs[i].iov_len = payload.size();
+        peers[i] = to;
+        headers[i].msg_hdr.msg_namelen = static_cast<socklen_t>(peers[i].size());
+        headers[i].msg_hdr.msg_flags = 0;
+    }
+
+    std::string_view payload(std::size_t i) const {
+        return std::string_view(static_cast<const char*>(iovs[i].iov_base), headers[i].msg_len);
+    }
+
+    bool truncated(std::size_t i) const {
+        return headers[i].msg_hdr.msg_flags & MSG_TRUNC;
+    }
+
+    const asio::ip::udp::endpoint& peer(std::size_t i) const {
+        return peers[i];
+    }
+
+    mmsghdr* data() { return headers.data(); }
+    std::size_t count() const { return headers.size(); }
+    std::size_t size() const { return slot_size; }
+private:
+    std::unique_ptr<char[]>                 bytes;
+    std::size_t                             slot_size;
+    std::vector<mmsghdr>                    headers;
+    std::vector<iovec>                      iovs;
+    std::vector<asio::ip::udp::endpoint>    peers;
+}; // class datagram_slab
+
+} // namespace detail
+
+struct datagram {
+    std::string_view                    data;
+    const asio::ip::udp::endpoint&      peer;
+    bool                                truncated;  // longer than a slab slot
+};
+
+// The datagrams of one receive, viewed in place in the receive slab; valid
+// until the next receive on the same socket.
+class datagram_batch {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = datagram;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = datagram;
+
+        iterator(const detail::datagram_slab* slab, std::size_t i) : slab(slab), i(i) {}
+
+        datagram operator*() const { return datagram{slab->payload(i), slab->peer(i), slab->truncated(i)}; }
+        iterator& operator++() { ++i; return *this; }
+        iterator operator++(int) { auto tmp = *this; ++i; return tmp; }
+        bool operator==(const iterator& other) const { return i == other.i; }
+        bool operator!=(const iterator& other) const { return i != other.i; }
+    private:
+        const detail::datagram_slab*    slab;
+        std::size_t                     i;
+    };
+
+    datagram_batch(const detail::datagram_slab& slab, std::size_t n) : slab(&slab), n(n) {}
+
+    datagram operator[](std::size_t i) const { return *iterator(slab, i); }
+    iterator begin() const { return iterator(slab, 0); }
+    iterator end() const { return iterator(slab, n); }
+    std::size_t size() const { return n; }
+    bool empty() const { return n == 0; }
+private:
+    const detail::datagram_slab*    slab;
+    std::size_t                     n;
+}; // class datagram_batch
+
+// Receives and sends datagrams on a UDP socket in batches with one
+// recvmmsg/sendmmsg system call each, through preallocated slabs. The
+// socket's reactor is only used to wait for readiness, so a completion
+// covers up to `batch` datagrams.
+class batched_udp {
+public:
+    explicit batched_udp(asio::ip::udp::socket& sock, std::size_t batch = 64, std::size_t max_datagram = 2048) :
+        sock(sock),
+        rx(batch, max_datagram),
+        tx(batch, max_datagram),
+        tx_queued(0)
+    {}
+
+    batched_udp(const batched_udp&) = delete;
+    batched_udp& operator=(const batched_udp&) = delete;
+
+    // handler: void(const std::error_code&, const datagram_batch&), the batch
+    // is never empty on success
+    template<typename Handler>
+    void async_receive(Handler&& handler) {
+        sock.async_wait(asio::socket_base::wait_read, [this, handler = std::forward<Handler>(handler)](const std::error_code& ec) mutable {
+            if (ec) {
+                return handler(ec, datagram_batch(rx, 0));
+            }
+
+            rx.prepare_receive(rx.count());
+            int n = ::recvmmsg(sock.native_handle(), rx.data(), static_cast<unsigned>(rx.count()), MSG_DONTWAIT, nullptr);
+            if (n <= 0) {
+                if (n == 0 || errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                    return async_receive(std::move(handler));
+                }
+                return handler(std::error_code(errno, std::system_category()), datagram_batch(rx, 0));
+            }
+
+            rx.finish_receive(static_cast<std::size_t>(n));
+            handler(std::error_code(), datagram_batch(rx, static_cast<std::size_t>(n)));
+        });
+    }
+
+    // copies a datagram into the send slab; false when the slab is full or
+    // the payload exceeds a slot, flush first
+    bool queue(std::string_view payload, const asio::ip::udp::endpoint& to) {
+        if (tx_queued == tx.count() || payload.size() > tx.size()) {
+            return false;
+        }
+
+        tx.prepare_send(tx_queued++, payload, to);
+        return true;
+    }
+
+    std::size_t queued() const noexcept {
+        return tx_queued;
+    }
+
+    // sends everything queued; handler: void(const std::error_code&, std::size_t sent).
+    // On error the datagrams not yet sent are dropped.
+    template<typename Handler>
+    void async_flush(Handler&& handler) {
+        flush(0, std::forward<Handler>(handler));
+    }
+private:
+    template<typename Handler>
+    void flush(std::size_t sent, Handler&& handler) {
+        std::error_code ec;
+        while (sent < tx_queued) {
+            int n = ::sendmmsg(sock.native_handle(), tx.data() + sent, static_cast<unsigned>(tx_queued - sent), MSG_DONTWAIT);
+            if (n >= 0) {
+                sent += static_cast<std::size_t>(n);
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                sock.async_wait(asio::socket_base::wait_write, [this, sent, handler = std::forward<Handler>(handler)](const std::error_code& ec) mutable {
+                    if (ec) {
+                        tx_queued = 0;
+                        return handler(ec, sent);
+                    }
+                    flush(sent, std::move(handler));
+                });
+                return;
+            } else if (errno != EINTR) {
+                ec = std::error_code(errno, std::system_category());
+                break;
+            }
+        }
+
+        tx_queued = 0;
+        asio::post(sock.get_executor(), [ec, sent, handler = std::forward<Handler>(handler)]() mutable {
+            handler(ec, sent);
+        });
+    }
+private:
+    asio::ip::udp::socket&      sock;
+    detail::datagram_slab       rx;
+    detail::datagram_slab       tx;
+    std::size_t                 tx_queued;
+}; // class batched_udp
+
+class datagrams_received {
+public:
+    datagrams_received(const datagram_batch& batch) noexcept : batch(batch) {}
+    datagram_batch batch;
+};
+
+class datagrams_sent {
+public:
+    datagrams_sent(std::size_t count) noexcept : count(count) {}
+    std::size_t count;
+};
+
+class datagram_failed {
+public:
+    datagram_failed(const std::error_code& ec) noexcept : ec(ec) {}
+    std::error_code ec;
+};
+
+class datagram_stopped {};
+
+// waits for the next batch of datagrams and hands it to the machine as one
+// event; the next state processes it and usually transitions back here
+class receiving_datagrams : public state<datagrams_received, datagram_failed, datagram_stopped> {
+public:
+    receiving_datagrams(asio::io_service& io, asio::ip::udp::socket& sock, batched_udp& udp) :
+        state(io),
+        sock(sock),
+        udp(udp)
+    {}
+
+    virtual void on_enter() override {
+        udp.async_receive(track([this](const std::error_code& ec, const datagram_batch& batch) {
+            if (ec) {
+                return ec == asio::error::operation_aborted ? complete<datagram_stopped>() : complete<datagram_failed>(ec);
+            }
+            complete<datagrams_received>(batch);
+        }));
+    }
+
+    virtual void cancel() override {
+        complete<datagram_stopped>();
+        sock.cancel();
+    }
+private:
+    asio::ip::udp::socket&  sock;
+    batched_udp&            udp;
+}; // class receiving_datagrams
+
+// sends the datagrams queued in `udp` with as few system calls as possible
+class sending_datagrams : public state<datagrams_sent, datagram_failed, datagram_stopped> {
+public:
+    sending_datagrams(asio::io_service& io, asio::ip::udp::socket& sock, batched_udp& udp) :
+        state(io),
+        sock(sock),
+        udp(udp)
+    {}
+
+    virtual void on_enter() override {
+        udp.async_flush(track([this](const std::error_code& ec, std::size_t sent) {
+            if (ec) {
+                return ec == asio::error::operation_aborted ? complete<datagram_stopped>() : complete<datagram_failed>(ec);
+            }
+            complete<datagrams_sent>(sent);
+        }));
+    }
+
+    virtual void cancel() override {
+        complete<datagram_stopped>();
+        sock.cancel();
+    }
+private:
+    asio::ip::udp::socket&  sock;
+    batched_udp&            udp;
+}; // class sending_datagrams
+
+} // namespace io
+} // namespace afsm
@@ -0,0 +1,30 @@
+#pragma once
+
+// std
+#include <cstddef>
+#include <system_error>
+
+namespace afsm {
+namespace io {
+
+// the outbound queue of the state went above its high watermark
+class send_backpressure {
+public:
+    send_backpressure(std::size_t queued) noexcept : queued(queued) {}
+    std::size_t queued;
+};
+
+// a write of the state's outbound queue failed
+class send_failed {
+public:
+    send_failed(const std::error_code& ec) noexcept : ec(ec) {}
+
+    operator std::error_code() const {
+        return ec;
+    }
+
+    std::error_code ec;
+};
+
+} // namespace io
+} // namespace afsm
@@ -0,0 +1,221 @@
+#pragma once
+
+// ours
+#include "framing.hpp"
+#include <afsm/detail/compacting_buffer.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+namespace afsm {
+namespace io {
+
+// the complete frames of one read, viewed in place in the reader's buffer;
+// the views are valid until the completion handler returns
+template<typename Framing>
+class frame_batch {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const std::string_view*;
+        using reference = std::string_view;
+
+        iterator() : batch(nullptr), offset(0) {}
+        iterator(const frame_batch* batch, std::size_t offset) :
+            batch(batch),
+            offset(offset),
+            cur(batch->find(offset))
+        {}
+
+        std::string_view operator*() const {
+            return std::string_view(batch->data + offset + cur->payload_offset, cur->payload_size);
+        }
+
+        iterator& operator++() {
+            offset += cur->size;
+            cur = batch->find(offset);
+            return *this;
+        }
+
+        iterator operator++(int) {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        bool operator==(const iterator& other) const {
+            return cur.has_value() == other.cur.has_value() && (!cur || offset == other.offset);
+        }
+
+        bool operator!=(const iterator& other) const {
+            return !(*this == other);
+        }
+    private:
+        const frame_batch*          batch;
+        std::size_t                 offset;
+        std::optional<frame_span>   cur;
+    };
+
+    frame_batch(const char* data, std::size_t size, const Framing& framing) :
+        data(data),
+        size(size),
+        framing(framing),
+        scanned(0)
+    {}
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(); }
+    bool empty() const { return begin() == end(); }
+
+    // bytes covered by complete frames, including the ones not iterated
+    std::size_t complete_bytes() const {
+        while (find(scanned)) {}
+        return scanned;
+    }
+private:
+    std::optional<frame_span> find(std::size_t offset) const {
+        auto f = framing.find(data + offset, size - offset);
+        if (f) {
+            scanned = std::max(scanned, offset + f->size);
+        }
+        return f;
+    }
+private:
+    const char*             data;
+    std::size_t             size;
+    const Framing&          framing;
+    mutable std::size_t     scanned;
+}; // class frame_batch
+
+inline asio::const_buffer as_buffer(std::string_view frame) {
+    return asio::buffer(frame.data(), frame.size());
+}
+
+// Reads a stream in large chunks into a bounded heap buffer and hands out
+// every complete frame of a chunk in one completion, without copying; only
+// the bytes of an incomplete frame are ever moved, to the buffer's front. The next
+// read is only issued when the owner asks for it, so a slow consumer stops
+// reading the socket instead of growing the buffer.
+//
+//   reader.async_read_frames(track([this](const std::error_code& ec, auto& frames) {
+//       for (std::string_view f : frames) { ... }
+//   }));
+template<typename Framing = delimited, typename Stream = asio::ip::tcp::socket>
+class framed_reader {
+public:
+    using frames = frame_batch<Framing>;
+
+    explicit framed_reader(Stream& stream, std::size_t capacity = 64 * 1024, Framing framing = Framing{}) :
+        stream(stream),
+        buf(capacity),
+        framing(std::move(framing)),
+        busy(false)
+    {}
+
+    // continues `from` on another stream (e.g. one moved with io::rehome()),
+    // the bytes of an incomplete frame are carried over
+    framed_reader(Stream& stream, framed_reader&& from) :
+        stream(stream),
+        buf(from.buf.capacity()),
+        framing(std::move(from.framing)),
+        busy(false)
+    {
+        auto p = from.pending();
+        std::memcpy(buf.write_ptr(), p.data(), p.size());
+        buf.commit(p.size());
+    }
+
+    framed_reader(const framed_reader&) = delete;
+    framed_reader& operator=(const framed_reader&) = delete;
+
+    // handler: void(const std::error_code&, frames&); frames not taken from
+    // the batch are dropped when the handler returns
+    template<typename Handler>
+    void async_read_frames(Handler&& handler) {
+        if (busy && buf.writable() < buf.capacity() / 2) {
+            // re-armed from a handler while its batch still fills the buffer,
+            // issued once the batch is consumed and the buffer compacted
+            deferred = std::make_unique<rearm_with<std::decay_t<Handler>>>(*this, std::forward<Handler>(handler));
+            return;
+        }
+
+        if (!busy) {
+            buf.compact();
+        }
+
+        if (buf.writable() == 0) {
+            // a single frame does not fit into the buffer
+            asio::post(stream.get_executor(), [this, handler = std::forward<Handler>(handler)]() mutable {
+                frames batch(buf.read_ptr(), 0, framing);
+                handler(make_error_code(std::errc::message_size), batch);
+            });
+            return;
+        }
+
+        // at most half of the buffer per read, so a handler re-arming the read
+        // normally finds free space next to the batch it is processing
+        auto chunk = std::min(buf.writable(), std::max<std::size_t>(buf.capacity() / 2, 1));
+        stream.async_read_some(asio::buffer(buf.write_ptr(), chunk), [this, handler = std::forward<Handler>(handler)](const std::error_code& ec, std::size_t n) mutable {
+            buf.commit(n);
+            frames batch(buf.read_ptr(), buf.readable(), framing);
+            busy = true;
+            handler(ec, batch);
+            busy = false;
+            buf.consume(batch.complete_bytes());
+            if (deferred) {
+                std::exchange(deferred, nullptr)->rearm();
+            }
+        });
+    }
+
+    // bytes received but not yet part of a complete frame
+    std::string_view pending() const {
+        return std::string_view(buf.read_ptr(), buf.readable());
+    }
+
+    std::size_t capacity() const {
+        return buf.capacity();
+    }
+private:
+    // a read handler waiting for its batch to be consumed; handlers need not
+    // be copyable, so no std::function
+    struct deferred_read {
+        virtual ~deferred_read() = default;
+        virtual void rearm() = 0;
+    };
+
+    template<typename Handler>
+    struct rearm_with : deferred_read {
+        rearm_with(framed_reader& reader, Handler handler) : reader(reader), handler(std::move(handler)) {}
+
+        virtual void rearm() override {
+            reader.async_read_frames(std::move(handler));
+        }
+
+        framed_reader&  reader;
+        Handler         handler;
+    };
+private:
+    Stream&                         stream;
+    detail::compacting_buffer       buf;
+    Framing                         framing;
+    bool                            busy;
+    std::unique_ptr<deferred_read>  deferred;
+}; // class framed_reader
+
+} // namespace io
+} // namespace afsm
@@ -0,0 +1,77 @@
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace afsm {
+namespace io {
+
+// location of one complete frame at the beginning of a byte range
+struct frame_span {
+    std::size_t payload_offset;
+    std::size_t payload_size;
+    std::size_t size;
+};
+
+// frames terminated by a delimiter, the delimiter is not part of the payload
+class delimited {
+public:
+    // an empty delimiter would match everywhere
+    explicit delimited(std::string_view delim = "\n") : delim(delim) {
+        if (delim.empty()) {
+            throw std::invalid_argument("empty frame delimiter");
+        }
+    }
+
+    std::optional<frame_span> find(const char* data, std::size_t size) const {
+        if (delim.size() == 1) {
+            auto* p = static_cast<const char*>(std::memchr(data, delim[0], size));
+            if (!p) {
+                return std::nullopt;
+            }
+            auto len = static_cast<std::size_t>(p - data);
+            return frame_span{0, len, len + 1};
+        }
+
+        auto pos = std::string_view(data, size).find(delim);
+        if (pos == std::string_view::npos) {
+            return std::nullopt;
+        }
+        return frame_span{0, pos, pos + delim.size()};
+    }
+private:
+    std::string delim;
+};
+
+// frames preceded by a big endian length header
+template<typename Length = std::uint32_t>
+class length_prefixed {
+public:
+    static_assert(std::is_unsigned_v<Length>, "length header must be an unsigned integer");
+
+    std::optional<frame_span> find(const char* data, std::size_t size) const {
+        if (size < sizeof(Length)) {
+            return std::nullopt;
+        }
+
+        std::size_t len = 0;
+        for (std::size_t i = 0; i < sizeof(Length); ++i) {
+            len = (len << 8) | static_cast<unsigned char>(data[i]);
+        }
+
+        if (size - sizeof(Length) < len) {
+            return std::nullopt;
+        }
+        return frame_span{sizeof(Length), len, sizeof(Length) + len};
+    }
+};
+
+} // namespace io
+} // namespace afsm
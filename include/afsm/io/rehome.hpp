@@ -0,0 +1,33 @@
+#pragma once
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <utility>
+
+namespace afsm {
+namespace io {
+
+// Moves a socket to another io_service without closing the connection: the
+// native handle is released from `sock`, cancelling its operations, and
+// adopted by a new socket of `to`. A socket already on `to` is just moved.
+//
+//   online(asio::io_service& io, online&& from) : state(io), sock(io::rehome(from.sock, io)) {}
+template<typename Socket>
+Socket rehome(Socket& sock, asio::io_service& to) {
+    if (&sock.get_executor().context() == &to) {
+        return std::move(sock);
+    }
+
+    if (!sock.is_open()) {
+        return Socket(to);
+    }
+
+    auto protocol = sock.local_endpoint().protocol();
+    auto fd = sock.release();
+    return Socket(to, protocol, fd);
+}
+
+} // namespace io
+} // namespace afsm
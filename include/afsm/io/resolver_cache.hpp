@@ -0,0 +1,270 @@
+#pragma once
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace afsm {
+namespace io {
+
+// Per io_service resolution cache. Concurrent lookups of the same
+// (host, service) share one underlying async_resolve, successful results are
+// kept for a TTL (failures for a shorter one) and can be fetched
+// synchronously with lookup().
+//
+// At most `capacity` entries are kept: expired ones are dropped when looked
+// up, and adding one beyond the capacity evicts the least recently used
+// entries that have no resolution in flight.
+//
+// Resolver is anything constructible from an io_service with
+// async_resolve(host, service, handler(ec, results)) and cancel(), which
+// allows replacing the system resolver with a local stand-in. It may also
+// invoke the handler from within async_resolve().
+template<typename Resolver = asio::ip::tcp::resolver>
+class basic_resolver_cache : public asio::io_service::service {
+public:
+    using endpoint_type = typename Resolver::endpoint_type;
+    using endpoints = std::vector<endpoint_type>;
+    using endpoints_ptr = std::shared_ptr<const endpoints>;
+    using handler_type = std::function<void(const std::error_code&, endpoints_ptr)>;
+    using ticket = std::uint64_t;
+    using clock = std::chrono::steady_clock;
+
+    static asio::io_service::id id;
+
+    explicit basic_resolver_cache(asio::io_service& io) :
+        asio::io_service::service(io),
+        io(io),
+        ttl(std::chrono::seconds(30)),
+        negative_ttl(std::chrono::seconds(1)),
+        capacity(4096),
+        next_ticket(1)
+    {}
+
+    void set_ttl(clock::duration positive, clock::duration negative) {
+        std::lock_guard<std::mutex> g(m);
+        ttl = positive;
+        negative_ttl = negative;
+    }
+
+    void set_capacity(std::size_t n) {
+        std::lock_guard<std::mutex> g(m);
+        capacity = n;
+        evict();
+    }
+
+    // entries kept, including the ones being resolved
+    std::size_t size() {
+        std::lock_guard<std::mutex> g(m);
+        return entries.size();
+    }
+
+    // cached endpoints or nullptr, never starts a resolution
+    endpoints_ptr lookup(std::string_view host, std::string_view service) {
+        std::lock_guard<std::mutex> g(m);
+        auto it = entries.find(make_key(host, service));
+        if (it == entries.end()) {
+            return nullptr;
+        }
+
+        auto& e = it->second;
+        if (e.expiry <= clock::now()) {
+            if (!e.resolver) {
+                erase(it);
+            }
+            return nullptr;
+        }
+        touch(e);
+        return e.eps;
+    }
+
+    // handler: void(const std::error_code&, endpoints_ptr), always invoked
+    // through the io_service; the ticket can be used to cancel the wait
+    template<typename Handler>
+    ticket async_resolve(std::string_view host, std::string_view service, Handler&& handler) {
+        std::unique_lock<std::mutex> g(m);
+        auto t = next_ticket++;
+        auto key = make_key(host, service);
+        auto [it, added] = entries.try_emplace(key);
+        auto& e = it->second;
+        if (added) {
+            e.pos = lru.insert(lru.begin(), key);
+        } else {
+            touch(e);
+        }
+
+        auto now = clock::now();
+        if (!e.resolver && e.expiry > now) {
+            asio::post(io, std::bind(std::forward<Handler>(handler), e.ec, e.eps));
+            return t;
+        }
+
+        e.waiters.emplace_back(t, handler_type(std::forward<Handler>(handler)));
+        tickets.emplace(t, key);
+        std::shared_ptr<Resolver> starting;
+        if (!e.resolver) {
+            e.resolver = starting = std::make_shared<Resolver>(io);
+        }
+        if (added) {
+            // the new entry is in flight by now, it is not a candidate
+            evict();
+        }
+        g.unlock();
+
+        // a resolver completing from within async_resolve() runs on_resolved(),
+        // which locks again and drops the entry's reference to it
+        if (starting) {
+            starting->async_resolve(std::string(host), std::string(service), [this, key = std::move(key)](const std::error_code& ec, auto results) {
+                on_resolved(key, ec, results);
+            });
+        }
+        return t;
+    }
+
+    // completes the waiter with operation_aborted, the lookup itself goes on
+    // since other waiters or later callers may use its result
+    void cancel(ticket t) {
+        std::lock_guard<std::mutex> g(m);
+        auto tit = tickets.find(t);
+        if (tit == tickets.end()) {
+            return;
+        }
+
+        auto& waiters = entries[tit->second].waiters;
+        for (auto it = waiters.begin(); it != waiters.end(); ++it) {
+            if (it->first == t) {
+                asio::post(io, std::bind(std::move(it->second), make_error_code(asio::error::operation_aborted), endpoints_ptr()));
+                waiters.erase(it);
+                break;
+            }
+        }
+        tickets.erase(tit);
+    }
+
+    // forgets finished entries, lookups in flight are kept
+    void clear() {
+        std::lock_guard<std::mutex> g(m);
+        for (auto it = entries.begin(); it != entries.end();) {
+            it = it->second.resolver ? std::next(it) : erase(it);
+        }
+    }
+private:
+    struct entry {
+        entry() : expiry(clock::time_point::min()) {}
+
+        endpoints_ptr                                   eps;
+        std::error_code                                 ec;
+        clock::time_point                               expiry;
+        std::shared_ptr<Resolver>                       resolver;
+        std::vector<std::pair<ticket, handler_type>>    waiters;
+        std::list<std::string>::iterator                pos;        // in the lru list
+    };
+
+    using entry_map = std::unordered_map<std::string, entry>;
+
+    void touch(entry& e) {
+        lru.splice(lru.begin(), lru, e.pos);
+    }
+
+    typename entry_map::iterator erase(typename entry_map::iterator it) {
+        lru.erase(it->second.pos);
+        return entries.erase(it);
+    }
+
+    // an entry being resolved has waiters and is never evicted
+    void evict() {
+        for (auto it = lru.end(); entries.size() > capacity && it != lru.begin();) {
+            auto eit = entries.find(*--it);
+            if (!eit->second.resolver) {
+                it = std::next(it);
+                erase(eit);
+            }
+        }
+    }
+
+    static std::string make_key(std::string_view host, std::string_view service) {
+        std::string key;
+        key.reserve(host.size() + service.size() + 1);
+        key.append(host).push_back('\0');
+        key.append(service);
+        return key;
+    }
+
+    template<typename Results>
+    void on_resolved(const std::string& key, std::error_code ec, const Results& results) {
+        std::vector<std::pair<ticket, handler_type>> waiters;
+        std::shared_ptr<Resolver> resolver;
+        endpoints_ptr eps;
+        {
+            std::lock_guard<std::mutex> g(m);
+            auto it = entries.find(key);
+            if (it == entries.end()) {
+                return;
+            }
+
+            auto& e = it->second;
+            if (!ec) {
+                auto list = std::make_shared<endpoints>();
+                for (const auto& r : results) {
+                    list->push_back(r.endpoint());
+                }
+                if (list->empty()) {
+                    ec = make_error_code(asio::error::host_not_found);
+                } else {
+                    eps = std::move(list);
+                }
+            }
+
+            e.eps = eps;
+            e.ec = ec;
+            e.expiry = clock::now() + (ec ? negative_ttl : ttl);
+            resolver = std::move(e.resolver);
+            waiters.swap(e.waiters);
+            for (auto& w : waiters) {
+                tickets.erase(w.first);
+            }
+        }
+
+        for (auto& w : waiters) {
+            asio::post(io, std::bind(std::move(w.second), ec, eps));
+        }
+    }
+
+    void shutdown() override {
+        std::lock_guard<std::mutex> g(m);
+        entries.clear();
+        tickets.clear();
+        lru.clear();
+    }
+private:
+    asio::io_service&                           io;
+    std::mutex                                  m;
+    entry_map                                   entries;
+    std::list<std::string>                      lru;        // most recently used first
+    std::unordered_map<ticket, std::string>     tickets;
+    clock::duration                             ttl;
+    clock::duration                             negative_ttl;
+    std::size_t                                 capacity;
+    ticket                                      next_ticket;
+}; // class basic_resolver_cache
+
+template<typename Resolver>
+asio::io_service::id basic_resolver_cache<Resolver>::id;
+
+using resolver_cache = basic_resolver_cache<>;
+
+} // namespace io
+} // namespace afsm
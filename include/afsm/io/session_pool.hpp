@@ -0,0 +1,165 @@
+#pragma once
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace afsm {
+namespace io {
+
+// Preallocated slots for per-connection machines, spread round robin over a
+// set of io_services (shards). Capacity is the admission limit: a slot is
+// reserved before accepting, so an acceptor stops accepting when the pool is
+// full and resumes when a session finishes. Released slots go to the
+// waiters in the order they asked for one.
+//
+// Session is a state_machine whose context is constructible from
+// (io_service&, asio::ip::tcp::socket&&).
+template<typename Session>
+class session_pool {
+public:
+    using slot = std::size_t;
+
+    session_pool(std::size_t capacity, std::vector<asio::io_service*> shards) :
+        slots(new std::optional<Session>[capacity]),
+        slot_shard(capacity),
+        running(0)
+    {
+        if (shards.empty()) {
+            throw std::invalid_argument("session_pool needs at least one io_service");
+        }
+
+        free.reserve(capacity);
+        for (auto i = capacity; i-- > 0;) {
+            free.push_back(i);
+            slot_shard[i] = shards[i % shards.size()];
+        }
+    }
+
+    session_pool(const session_pool&) = delete;
+    session_pool& operator=(const session_pool&) = delete;
+
+    // a free slot, or nullopt when the pool is full; `on_available` is then
+    // posted to `io` as soon as a slot is released or notify(owner) is called
+    std::optional<slot> reserve(asio::io_service& io, std::function<void()> on_available, const void* owner = nullptr) {
+        std::lock_guard<std::mutex> g(m);
+        if (free.empty()) {
+            waiters.push_back({&io, owner, std::move(on_available)});
+            return std::nullopt;
+        }
+
+        auto s = free.back();
+        free.pop_back();
+        return s;
+    }
+
+    // io_service the session in slot `s` runs on, sockets are accepted directly into it
+    asio::io_service& shard(slot s) const {
+        return *slot_shard[s];
+    }
+
+    // starts a session in a reserved slot, on the slot's shard
+    void spawn(slot s, asio::ip::tcp::socket sock) {
+        running.fetch_add(1, std::memory_order_relaxed);
+        asio::post(shard(s), [this, s, sock = std::move(sock)]() mutable {
+            slots[s].emplace(shard(s));
+            slots[s]->async_wait([this, s](const typename Session::result&) {
+                // the machine does not touch itself after invoking us
+                slots[s].reset();
+                running.fetch_sub(1, std::memory_order_relaxed);
+                release(s);
+            }, std::move(sock));
+        });
+    }
+
+    // gives back a reserved slot that was not used (failed accept)
+    void release(slot s) {
+        waiter w;
+        {
+            std::lock_guard<std::mutex> g(m);
+            free.push_back(s);
+            if (waiters.empty()) {
+                return;
+            }
+            w = std::move(waiters.front());
+            waiters.pop_front();
+        }
+        asio::post(*w.io, std::move(w.on_available));
+    }
+
+    // wakes the waiters reserved for `owner` (e.g. a stopping acceptor),
+    // other acceptors of the pool keep waiting for a slot
+    void notify(const void* owner) {
+        std::vector<waiter> ws;
+        {
+            std::lock_guard<std::mutex> g(m);
+            auto it = std::stable_partition(waiters.begin(), waiters.end(), [owner](const waiter& w) { return w.owner != owner; });
+            ws.assign(std::make_move_iterator(it), std::make_move_iterator(waiters.end()));
+            waiters.erase(it, waiters.end());
+        }
+        for (auto& w : ws) {
+            asio::post(*w.io, std::move(w.on_available));
+        }
+    }
+
+    // wakes everybody waiting for a slot
+    void notify_all() {
+        std::deque<waiter> ws;
+        {
+            std::lock_guard<std::mutex> g(m);
+            ws.swap(waiters);
+        }
+        for (auto& w : ws) {
+            asio::post(*w.io, std::move(w.on_available));
+        }
+    }
+
+    // cancels every running session on its shard
+    void cancel_all() {
+        for (std::size_t s = 0; s < slot_shard.size(); ++s) {
+            asio::post(shard(s), [this, s] {
+                if (slots[s]) {
+                    slots[s]->cancel();
+                }
+            });
+        }
+    }
+
+    // sessions spawned and not yet finished
+    std::size_t active() const noexcept {
+        return running.load(std::memory_order_relaxed);
+    }
+
+    std::size_t capacity() const noexcept {
+        return slot_shard.size();
+    }
+private:
+    struct waiter {
+        asio::io_service*       io;
+        const void*             owner;
+        std::function<void()>   on_available;
+    };
+private:
+    std::unique_ptr<std::optional<Session>[]>                       slots;
+    std::vector<asio::io_service*>                                  slot_shard;
+    std::mutex                                                      m;
+    std::vector<slot>                                               free;
+    std::deque<waiter>                                              waiters;
+    std::atomic<std::size_t>                                        running;
+}; // class session_pool
+
+} // namespace io
+} // namespace afsm
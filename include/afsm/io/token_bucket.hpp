@@ -0,0 +1,139 @@
+#pragma once
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <system_error>
+#include <utility>
+
+namespace afsm {
+namespace io {
+
+// Admission control shared by every machine of an io_service: a token bucket
+// refilled at `rate` tokens per second holding at most `burst` tokens. States
+// acquire a token before starting expensive work (resolving, connecting), so
+// a whole fleet reconnecting at once is admitted at a bounded rate. Waiters
+// are served in FIFO order; unconfigured buckets admit everything.
+class token_bucket : public asio::io_service::service {
+public:
+    using ticket = std::uint64_t;
+    using handler_type = std::function<void(const std::error_code&)>;
+    using clock = std::chrono::steady_clock;
+
+    static inline asio::io_service::id id;
+
+    explicit token_bucket(asio::io_service& io) :
+        asio::io_service::service(io),
+        io(io),
+        timer(io),
+        rate(0),
+        burst(0),
+        tokens(0),
+        last(clock::now()),
+        timer_armed(false),
+        next_ticket(1)
+    {}
+
+    // rate == 0 disables throttling
+    void configure(double rate, double burst) {
+        std::lock_guard<std::mutex> g(m);
+        this->rate = rate;
+        this->burst = std::max(burst, 1.0);
+        tokens = this->burst;
+        last = clock::now();
+        serve();
+    }
+
+    bool try_acquire() {
+        std::lock_guard<std::mutex> g(m);
+        if (rate <= 0) {
+            return true;
+        }
+
+        refill();
+        if (waiters.empty() && tokens >= 1) {
+            tokens -= 1;
+            return true;
+        }
+        return false;
+    }
+
+    // handler: void(const std::error_code&), always invoked through the io_service
+    template<typename Handler>
+    ticket async_acquire(Handler&& handler) {
+        std::lock_guard<std::mutex> g(m);
+        auto t = next_ticket++;
+        waiters.emplace_back(t, handler_type(std::forward<Handler>(handler)));
+        serve();
+        return t;
+    }
+
+    // completes a pending acquisition with operation_aborted
+    void cancel(ticket t) {
+        std::lock_guard<std::mutex> g(m);
+        auto it = std::find_if(waiters.begin(), waiters.end(), [t](auto& w) { return w.first == t; });
+        if (it != waiters.end()) {
+            asio::post(io, std::bind(std::move(it->second), make_error_code(asio::error::operation_aborted)));
+            waiters.erase(it);
+        }
+    }
+private:
+    void refill() {
+        auto now = clock::now();
+        std::chrono::duration<double> elapsed = now - last;
+        tokens = std::min(burst, tokens + elapsed.count() * rate);
+        last = now;
+    }
+
+    // hands out tokens to waiters, must be called with the lock held
+    void serve() {
+        if (rate > 0) {
+            refill();
+        }
+
+        while (!waiters.empty() && (rate <= 0 || tokens >= 1)) {
+            if (rate > 0) {
+                tokens -= 1;
+            }
+            asio::post(io, std::bind(std::move(waiters.front().second), std::error_code()));
+            waiters.pop_front();
+        }
+
+        if (!waiters.empty() && !timer_armed) {
+            timer_armed = true;
+            std::chrono::duration<double> wait((1 - tokens) / rate);
+            timer.expires_after(std::chrono::duration_cast<clock::duration>(wait));
+            timer.async_wait([this](const std::error_code&) {
+                std::lock_guard<std::mutex> g(m);
+                timer_armed = false;
+                serve();
+            });
+        }
+    }
+
+    void shutdown() override {
+        std::lock_guard<std::mutex> g(m);
+        waiters.clear();
+    }
+private:
+    asio::io_service&                               io;
+    std::mutex                                      m;
+    asio::steady_timer                              timer;
+    double                                          rate;
+    double                                          burst;
+    double                                          tokens;
+    clock::time_point                               last;
+    std::deque<std::pair<ticket, handler_type>>     waiters;
+    bool                                            timer_armed;
+    ticket                                          next_ticket;
+}; // class token_bucket
+
+} // namespace io
+} // namespace afsm
@@ -0,0 +1,284 @@
+#pragma once
+
+// ours
+#include "events.hpp"
+#include <afsm/util/contains.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace afsm {
+namespace io {
+
+struct watermarks {
+    std::size_t low = 256 * 1024;
+    std::size_t high = 1024 * 1024;
+};
+
+// Outbound queue of a connected state. Everything queued while a write is in
+// flight goes out with the next write as one buffer sequence (writev), so
+// there is at most one write in flight and one syscall per batch instead of
+// one per message.
+//
+// A message taking the queue to its high watermark is refused and completes
+// the owner with send_backpressure if that is one of its events; otherwise it
+// is queued. Either way the queue refuses new messages until it drains to the
+// low watermark. That is not signalled: writable() (sender::writable() from
+// other threads) tells when messages are accepted again. A failed write
+// completes the owner with send_failed, which therefore has to be one of its
+// events. Messages accepted by a sender but refused by the queue once they
+// reach it are counted as dropped.
+template<typename Owner, typename Stream = asio::ip::tcp::socket>
+class write_queue {
+private:
+    static_assert(util::variant_contains<send_failed, typename Owner::result>::value, "the owner of a write_queue has to complete with io::send_failed");
+
+    using executor_type = typename Stream::executor_type;
+
+    // messages handed over by other threads, drained on the owner's executor
+    struct inbox : std::enable_shared_from_this<inbox> {
+        inbox(executor_type ex) : ex(std::move(ex)), q(nullptr), scheduled(false), blocked(false), dropped(0) {}
+
+        void drain(const executor_type& on) {
+            std::vector<std::string> msgs;
+            write_queue* target;
+            {
+                std::lock_guard<std::mutex> g(m);
+                if (on != ex) {
+                    // the queue moved to another io_service meanwhile
+                    asio::post(ex, [self = this->shared_from_this(), ex = ex] { self->drain(ex); });
+                    return;
+                }
+                scheduled = false;
+                msgs.swap(this->msgs);
+                target = q;
+            }
+
+            auto it = msgs.begin();
+            while (it != msgs.end() && target && target->send(std::move(*it))) {
+                ++it;
+            }
+            dropped.fetch_add(static_cast<std::size_t>(std::distance(it, msgs.end())), std::memory_order_relaxed);
+        }
+
+        std::mutex                  m;
+        executor_type               ex;
+        write_queue*                q;
+        std::vector<std::string>    msgs;
+        bool                        scheduled;
+        bool                        blocked;
+        std::atomic<std::size_t>    dropped;
+    };
+public:
+    // thread safe handle for feeding the queue from outside the machine
+    class sender {
+    public:
+        explicit sender(std::shared_ptr<inbox> in) : in(std::move(in)) {}
+
+        // false if the queue is gone or above its high watermark; an accepted
+        // message may still be dropped, see dropped()
+        bool send(std::string msg) const {
+            std::lock_guard<std::mutex> g(in->m);
+            if (!in->q || in->blocked) {
+                return false;
+            }
+
+            in->msgs.push_back(std::move(msg));
+            if (!std::exchange(in->scheduled, true)) {
+                asio::post(in->ex, [in = in, ex = in->ex] { in->drain(ex); });
+            }
+            return true;
+        }
+
+        // false while the queue is gone or has not drained to its low
+        // watermark yet, send() refuses messages then
+        bool writable() const {
+            std::lock_guard<std::mutex> g(in->m);
+            return in->q && !in->blocked;
+        }
+
+        // messages accepted here that the queue refused (or was gone for)
+        std::size_t dropped() const noexcept {
+            return in->dropped.load(std::memory_order_relaxed);
+        }
+    private:
+        std::shared_ptr<inbox> in;
+    };
+
+    write_queue(Owner& owner, Stream& stream, watermarks wm = {}) :
+        owner(owner),
+        stream(stream),
+        wm(wm),
+        in(std::make_shared<inbox>(stream.get_executor())),
+        queued_bytes(0),
+        writing(false),
+        blocked(false)
+    {
+        in->q = this;
+    }
+
+    // continues `from` of a suspended owner on another stream (see
+    // state::suspend()): what it had not written yet is written here, its
+    // senders feed this queue from now on
+    write_queue(Owner& owner, Stream& stream, write_queue&& from) :
+        owner(owner),
+        stream(stream),
+        wm(from.wm),
+        in(std::move(from.in)),
+        pending(std::move(from.pending)),
+        queued_bytes(std::exchange(from.queued_bytes, 0)),
+        writing(false),
+        blocked(from.blocked),
+        ec(from.ec)
+    {
+        std::lock_guard<std::mutex> g(in->m);
+        in->q = this;
+        in->ex = stream.get_executor();
+    }
+
+    write_queue(const write_queue&) = delete;
+    write_queue& operator=(const write_queue&) = delete;
+
+    ~write_queue() {
+        if (in) {
+            std::lock_guard<std::mutex> g(in->m);
+            in->q = nullptr;
+        }
+    }
+
+    // returns false if the message was refused
+    bool send(std::string msg) {
+        if (blocked || ec || !owner.active()) {
+            return false;
+        }
+
+        if (queued_bytes + msg.size() >= wm.high) {
+            set_blocked(true);
+            if constexpr (util::variant_contains<send_backpressure, typename Owner::result>::value) {
+                owner.template complete<send_backpressure>(queued_bytes + msg.size());
+                return false;
+            }
+        }
+
+        queued_bytes += msg.size();
+        pending.push_back(std::move(msg));
+
+        if (!writing) {
+            start_write();
+        }
+        return true;
+    }
+
+    // starts writing what a queue moved from a suspended owner had left
+    void resume() {
+        if (!writing && !pending.empty() && owner.active()) {
+            start_write();
+        }
+    }
+
+    sender get_sender() const {
+        return sender(in);
+    }
+
+    std::size_t queued() const noexcept {
+        return queued_bytes;
+    }
+
+    bool writable() const noexcept {
+        return !blocked && !ec;
+    }
+
+    // the first write error, later sends are refused
+    const std::error_code& error() const noexcept {
+        return ec;
+    }
+
+    std::size_t dropped() const noexcept {
+        return in->dropped.load(std::memory_order_relaxed);
+    }
+private:
+    void start_write() {
+        writing = true;
+        inflight.swap(pending);
+        iov.clear();
+        iov.reserve(inflight.size());
+        for (auto& msg : inflight) {
+            iov.push_back(asio::buffer(msg));
+        }
+
+        asio::async_write(stream, iov, owner.track([this](const std::error_code& ec, std::size_t n) {
+            writing = false;
+            if (ec && !owner.active()) {
+                // stopped by the owner, which may be moved on with what is left
+                return requeue_unwritten(n);
+            }
+
+            for (auto& msg : inflight) {
+                queued_bytes -= msg.size();
+            }
+            inflight.clear();
+
+            if (ec) {
+                this->ec = ec;
+                return owner.template complete<send_failed>(ec);
+            }
+
+            if (blocked && queued_bytes <= wm.low) {
+                set_blocked(false);
+            }
+
+            if (!pending.empty() && owner.active()) {
+                start_write();
+            }
+        }));
+    }
+
+    // the first `written` bytes of the batch in flight went out, the rest is
+    // queued again in front of what came meanwhile
+    void requeue_unwritten(std::size_t written) {
+        auto it = inflight.begin();
+        for (; it != inflight.end() && written >= it->size(); ++it) {
+            written -= it->size();
+            queued_bytes -= it->size();
+        }
+        if (it != inflight.end()) {
+            it->erase(0, written);
+            queued_bytes -= written;
+        }
+        pending.insert(pending.begin(), std::make_move_iterator(it), std::make_move_iterator(inflight.end()));
+        inflight.clear();
+    }
+
+    void set_blocked(bool b) {
+        blocked = b;
+        std::lock_guard<std::mutex> g(in->m);
+        in->blocked = b;
+    }
+private:
+    Owner&                          owner;
+    Stream&                         stream;
+    watermarks                      wm;
+    std::shared_ptr<inbox>          in;
+    std::vector<std::string>        pending;
+    std::vector<std::string>        inflight;
+    std::vector<asio::const_buffer> iov;
+    std::size_t                     queued_bytes;
+    bool                            writing;
+    bool                            blocked;
+    std::error_code                 ec;
+}; // class write_queue
+
+} // namespace io
+} // namespace afsm
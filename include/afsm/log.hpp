@@ -0,0 +1,313 @@
+#pragma once
+
+// ours
+#include "detail/log_ring.hpp"
+#include "util/coarse_clock.hpp"
+#include "util/scope_exit.hpp"
+#include "util/type_name.hpp"
+
+// thirdparty
+#include <fmt/format.h>
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// lines below this level are compiled out: 0 trace, 1 debug, 2 info, 3 warn, 4 error, 5 off
+#ifndef AFSM_LOG_LEVEL
+#define AFSM_LOG_LEVEL 2
+#endif
+
+template <> struct fmt::formatter<afsm::util::lazy_type_name> : fmt::formatter<std::string_view> {
+    template <typename FormatContext>
+    auto format(const afsm::util::lazy_type_name& tn, FormatContext& ctx) {
+        auto name = tn.str();
+        return fmt::formatter<std::string_view>::format(std::string_view(name), ctx);
+    }
+};
+
+namespace afsm {
+namespace log {
+
+enum class level : int { trace, debug, info, warn, error, off };
+
+inline constexpr level active_level = static_cast<level>(AFSM_LOG_LEVEL);
+
+template<level L>
+inline constexpr bool enabled = L != level::off && static_cast<int>(L) >= static_cast<int>(active_level);
+
+namespace detail {
+
+inline const char* level_name(int lvl) {
+    static const char* names[] = {"trace", "debug", "info", "warn", "error"};
+    return lvl >= 0 && lvl < 5 ? names[lvl] : "?";
+}
+
+// arguments are formatted later on another thread, so views have to be
+// turned into owning strings while the caller still keeps them alive
+template<typename T>
+struct capture {
+    using type = std::decay_t<T>;
+};
+
+template<> struct capture<const char*> { using type = std::string; };
+template<> struct capture<char*> { using type = std::string; };
+template<> struct capture<std::string_view> { using type = std::string; };
+
+template<typename T>
+using capture_t = typename capture<std::decay_t<T>>::type;
+
+template<typename Tuple>
+void format_payload(afsm::detail::log_record& r, fmt::memory_buffer& out) {
+    auto* args = std::launder(reinterpret_cast<Tuple*>(r.payload));
+    util::scope_exit _([args] { args->~Tuple(); });
+    try {
+        std::apply([&](const auto& ...a) {
+            fmt::format_to(std::back_inserter(out), r.fmt, a...);
+        }, *args);
+    } catch (const std::exception& e) {
+        fmt::format_to(std::back_inserter(out), "<bad log line \"{}\": {}>", r.fmt, e.what());
+    }
+}
+
+// "YYYY-mm-dd HH:MM:SS.fff", localtime is only consulted once per second
+class timestamp_cache {
+public:
+    timestamp_cache() : sec(-1), len(0) {}
+
+    std::string_view format(std::chrono::system_clock::time_point tp) {
+        using namespace std::chrono;
+        auto since_epoch = duration_cast<milliseconds>(tp.time_since_epoch());
+        std::time_t s = static_cast<std::time_t>(duration_cast<seconds>(since_epoch).count());
+        if (s != sec) {
+            std::tm tm;
+            ::localtime_r(&s, &tm);
+            len = std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+            sec = s;
+        }
+        auto ms = static_cast<int>(since_epoch.count() % 1000);
+        buf[len] = '.';
+        buf[len + 1] = static_cast<char>('0' + ms / 100);
+        buf[len + 2] = static_cast<char>('0' + ms / 10 % 10);
+        buf[len + 3] = static_cast<char>('0' + ms % 10);
+        return std::string_view(buf, len + 4);
+    }
+private:
+    std::time_t     sec;
+    std::size_t     len;
+    char            buf[32];
+}; // class timestamp_cache
+
+// drains the per-thread rings, formats and writes the lines
+class backend {
+public:
+    static backend& instance() {
+        static backend b;
+        return b;
+    }
+
+    backend(const backend&) = delete;
+    backend& operator=(const backend&) = delete;
+
+    ~backend() {
+        {
+            std::lock_guard<std::mutex> g(m);
+            stopped = true;
+        }
+        cv.notify_one();
+        worker.join();
+    }
+
+    std::shared_ptr<afsm::detail::log_ring> attach() {
+        auto ring = std::make_shared<afsm::detail::log_ring>();
+        std::lock_guard<std::mutex> g(m);
+        rings.push_back(ring);
+        return ring;
+    }
+
+    void set_output(std::ostream& os) {
+        std::lock_guard<std::mutex> g(out_m);
+        out = &os;
+    }
+
+    // waits until everything logged before the call has been written: the
+    // worker is woken and reports back after its next pass found every ring
+    // empty
+    void flush() {
+        std::unique_lock<std::mutex> l(m);
+        auto request = ++flush_requested;
+        cv.notify_one();
+        flushed_cv.wait(l, [&] { return flushed >= request; });
+    }
+private:
+    backend() : out(&std::clog), stopped(false), flush_requested(0), flushed(0), worker([this] { run(); }) {}
+
+    void run() {
+        std::vector<std::shared_ptr<afsm::detail::log_ring>> snapshot;
+        fmt::memory_buffer line;
+        for (;;) {
+            bool stopping;
+            std::uint64_t requested;
+            {
+                std::unique_lock<std::mutex> l(m);
+                // retired rings are dropped once drained, their thread is gone
+                rings.erase(std::remove_if(rings.begin(), rings.end(), [](auto& r) { return r->is_retired() && r->empty(); }), rings.end());
+                snapshot = rings;
+                stopping = stopped;
+                requested = flush_requested;
+            }
+
+            bool idle = true;
+            {
+                std::lock_guard<std::mutex> g(out_m);
+                for (auto& ring : snapshot) {
+                    if (auto n = ring->take_dropped()) {
+                        *out << fmt::format("[{}] warn: {} log lines dropped\n", ts.format(util::coarse_clock::now()), n);
+                    }
+                    while (auto* r = ring->front()) {
+                        idle = false;
+                        line.clear();
+                        fmt::format_to(std::back_inserter(line), "[{}] {}: ", ts.format(r->ts), level_name(r->lvl));
+                        r->format(*r, line);
+                        line.push_back('\n');
+                        ring->pop();
+                        out->write(line.data(), static_cast<std::streamsize>(line.size()));
+                    }
+                }
+                if (idle) {
+                    out->flush();
+                }
+            }
+
+            if (idle) {
+                std::unique_lock<std::mutex> l(m);
+                if (flushed < requested) {
+                    flushed = requested;
+                    flushed_cv.notify_all();
+                }
+                if (stopping) {
+                    return;
+                }
+                if (flush_requested == requested) {
+                    cv.wait_for(l, std::chrono::milliseconds(1));
+                }
+            }
+        }
+    }
+private:
+    std::mutex                                                  m;
+    std::condition_variable                                     cv;
+    std::condition_variable                                     flushed_cv;
+    std::vector<std::shared_ptr<afsm::detail::log_ring>>        rings;
+    std::mutex                                                  out_m;
+    std::ostream*                                               out;
+    timestamp_cache                                             ts;
+    bool                                                        stopped;
+    std::uint64_t                                               flush_requested;
+    std::uint64_t                                               flushed;
+    std::thread                                                 worker;
+}; // class backend
+
+inline afsm::detail::log_ring& local_ring() {
+    struct holder {
+        holder() : ring(backend::instance().attach()) {}
+        ~holder() { ring->retire(); }
+        std::shared_ptr<afsm::detail::log_ring> ring;
+    };
+    thread_local holder h;
+    return *h.ring;
+}
+
+template<typename Tuple, typename ...Args>
+void emplace(afsm::detail::log_record& r, const char* fmt, Args&& ...args) {
+    if constexpr (sizeof(Tuple) <= afsm::detail::log_record::payload_size && alignof(Tuple) <= alignof(std::max_align_t)) {
+        r.fmt = fmt;
+        r.format = &format_payload<Tuple>;
+        new (r.payload) Tuple(std::forward<Args>(args)...);
+    } else {
+        // does not fit into the slot, pay for formatting on the caller's thread
+        using fallback = std::tuple<std::string>;
+        r.fmt = "{}";
+        r.format = &format_payload<fallback>;
+        new (r.payload) fallback(fmt::format(fmt, std::forward<Args>(args)...));
+    }
+}
+
+} // namespace detail
+
+// the format string is not copied, it must have static storage duration
+template<level L, typename ...Args>
+void write(const char* fmt, Args&& ...args) {
+    if constexpr (enabled<L>) {
+        auto& ring = detail::local_ring();
+        auto* r = ring.claim();
+        if (!r) {
+            return;
+        }
+        r->ts = util::coarse_clock::now();
+        r->lvl = static_cast<int>(L);
+        detail::emplace<std::tuple<detail::capture_t<Args>...>>(*r, fmt, std::forward<Args>(args)...);
+        ring.publish();
+    }
+}
+
+template<typename ...Args>
+void trace(const char* fmt, Args&& ...args) {
+    write<level::trace>(fmt, std::forward<Args>(args)...);
+}
+
+template<typename ...Args>
+void debug(const char* fmt, Args&& ...args) {
+    write<level::debug>(fmt, std::forward<Args>(args)...);
+}
+
+template<typename ...Args>
+void info(const char* fmt, Args&& ...args) {
+    write<level::info>(fmt, std::forward<Args>(args)...);
+}
+
+template<typename ...Args>
+void warn(const char* fmt, Args&& ...args) {
+    write<level::warn>(fmt, std::forward<Args>(args)...);
+}
+
+template<typename ...Args>
+void error(const char* fmt, Args&& ...args) {
+    write<level::error>(fmt, std::forward<Args>(args)...);
+}
+
+inline void set_output(std::ostream& os) {
+    detail::backend::instance().set_output(os);
+}
+
+inline void flush() {
+    detail::backend::instance().flush();
+}
+
+} // namespace log
+} // namespace afsm
+
+// unlike the functions above, the macros do not even evaluate their
+// arguments when the level is compiled out
+#define AFSM_LOG(lvl, ...) \
+    do { if constexpr (::afsm::log::enabled<lvl>) ::afsm::log::write<lvl>(__VA_ARGS__); } while (0)
+#define AFSM_LOG_TRACE(...) AFSM_LOG(::afsm::log::level::trace, __VA_ARGS__)
+#define AFSM_LOG_DEBUG(...) AFSM_LOG(::afsm::log::level::debug, __VA_ARGS__)
+#define AFSM_LOG_INFO(...)  AFSM_LOG(::afsm::log::level::info, __VA_ARGS__)
+#define AFSM_LOG_WARN(...)  AFSM_LOG(::afsm::log::level::warn, __VA_ARGS__)
+#define AFSM_LOG_ERROR(...) AFSM_LOG(::afsm::log::level::error, __VA_ARGS__)
@@ -0,0 +1,385 @@
+#pragma once
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+// system
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace afsm {
+namespace detail {
+
+// Layout of the shared memory table, fixed size so that a reader built
+// separately can map it:
+//
+//   registry_header
+//   registry_type[max_types]
+//   std::atomic<std::uint32_t>[capacity]    (type << 16 | state index), 0 = unused
+//
+// State index 0 is the idle (not started or finished) machine.
+struct registry_header {
+    static constexpr char magic_value[8] = {'a', 'f', 's', 'm', 'm', 'o', 'n', '1'};
+    static constexpr std::uint32_t name_size = 96;
+    static constexpr std::uint32_t max_types = 64;
+    static constexpr std::uint32_t max_states = 64;
+
+    char                            magic[8];
+    std::uint32_t                   capacity;
+    std::atomic<std::uint32_t>      types;      // published registry_type entries
+    std::atomic<std::uint32_t>      used;       // slots handed out at least once
+    std::uint32_t                   pid;
+};
+
+struct registry_type {
+    char            machine[registry_header::name_size];
+    std::uint32_t   states;
+    char            state[registry_header::max_states][registry_header::name_size];
+};
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free, "slots are read from other processes");
+
+inline std::size_t registry_size(std::size_t capacity) {
+    return sizeof(registry_header) + sizeof(registry_type) * registry_header::max_types + sizeof(std::atomic<std::uint32_t>) * capacity;
+}
+
+inline void copy_name(char* to, std::string_view from) {
+    auto n = std::min<std::size_t>(from.size(), registry_header::name_size - 1);
+    std::memcpy(to, from.data(), n);
+    to[n] = '\0';
+}
+
+} // namespace detail
+
+// Read-only view of a state table, in this process (state_registry::table())
+// or mapped from another one (state_table::open()). Reading is plain loads,
+// the machines being watched are not disturbed.
+class state_table {
+public:
+    struct count {
+        std::string_view    machine;
+        std::string_view    state;
+        std::size_t         machines;
+    };
+
+    // maps the table published under `name` by another process
+    static state_table open(const std::string& name) {
+        int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            throw std::system_error(errno, std::system_category(), "shm_open " + name);
+        }
+
+        struct stat st{};
+        ::fstat(fd, &st);
+        void* p = st.st_size >= static_cast<off_t>(sizeof(detail::registry_header))
+            ? ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0)
+            : MAP_FAILED;
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            throw std::runtime_error("cannot map state table " + name);
+        }
+
+        auto* h = static_cast<const detail::registry_header*>(p);
+        if (std::memcmp(h->magic, detail::registry_header::magic_value, sizeof(h->magic)) != 0
+            || detail::registry_size(h->capacity) > static_cast<std::size_t>(st.st_size)) {
+            ::munmap(p, static_cast<std::size_t>(st.st_size));
+            throw std::runtime_error("not a state table: " + name);
+        }
+        return state_table(p, static_cast<std::size_t>(st.st_size), true);
+    }
+
+    state_table(state_table&& other) noexcept :
+        base(std::exchange(other.base, nullptr)),
+        size(other.size),
+        owned(other.owned)
+    {}
+
+    state_table& operator=(state_table&&) = delete;
+    state_table(const state_table&) = delete;
+
+    ~state_table() {
+        if (owned && base) {
+            ::munmap(base, size);
+        }
+    }
+
+    std::uint32_t pid() const noexcept { return header().pid; }
+    std::size_t capacity() const noexcept { return header().capacity; }
+
+    // slots ever used, the ones above are guaranteed to be empty
+    std::size_t used() const noexcept {
+        return std::min<std::size_t>(header().used.load(std::memory_order_acquire), header().capacity);
+    }
+
+    // machines per (machine type, state), idle machines included
+    std::vector<count> counts() const {
+        auto ntypes = header().types.load(std::memory_order_acquire);
+        std::vector<std::vector<std::size_t>> n(ntypes);
+        for (std::uint32_t t = 0; t < ntypes; ++t) {
+            n[t].resize(type(t).states);
+        }
+
+        for (std::size_t i = 0, end = used(); i < end; ++i) {
+            auto v = slots()[i].load(std::memory_order_relaxed);
+            auto t = v >> 16, s = v & 0xffff;
+            if (t > 0 && t <= ntypes && s < n[t - 1].size()) {
+                ++n[t - 1][s];
+            }
+        }
+
+        std::vector<count> result;
+        for (std::uint32_t t = 0; t < ntypes; ++t) {
+            for (std::uint32_t s = 0; s < n[t].size(); ++s) {
+                result.push_back(count{type(t).machine, type(t).state[s], n[t][s]});
+            }
+        }
+        return result;
+    }
+
+    // (machine type, state) of the machine in `slot`, empty views if unused
+    std::pair<std::string_view, std::string_view> state_of(std::size_t slot) const {
+        if (slot >= capacity()) {
+            return {};
+        }
+
+        auto v = slots()[slot].load(std::memory_order_relaxed);
+        auto t = v >> 16, s = v & 0xffff;
+        if (t == 0 || t > header().types.load(std::memory_order_acquire) || s >= type(t - 1).states) {
+            return {};
+        }
+        return {type(t - 1).machine, type(t - 1).state[s]};
+    }
+protected:
+    state_table(void* base, std::size_t size, bool owned) : base(base), size(size), owned(owned) {}
+
+    const detail::registry_header& header() const noexcept {
+        return *static_cast<const detail::registry_header*>(base);
+    }
+
+    const detail::registry_type& type(std::uint32_t t) const noexcept {
+        return reinterpret_cast<const detail::registry_type*>(static_cast<const char*>(base) + sizeof(detail::registry_header))[t];
+    }
+
+    std::atomic<std::uint32_t>* slots() const noexcept {
+        return reinterpret_cast<std::atomic<std::uint32_t>*>(static_cast<char*>(base) + sizeof(detail::registry_header)
+            + sizeof(detail::registry_type) * detail::registry_header::max_types);
+    }
+protected:
+    void*           base;
+    std::size_t     size;
+    bool            owned;
+}; // class state_table
+
+// Owner of a shared memory state table (POSIX shm, /dev/shm/<name>) with a
+// slot per monitored machine. Machines publish their active state with a
+// single relaxed store (see state_machine::monitor()); slots and machine
+// types are handed out under a lock, which only happens when a machine
+// starts being monitored.
+//
+// The name must be free: a table of another process (or a stale one) is
+// never replaced, construction fails with EEXIST instead.
+class state_registry : public state_table {
+public:
+    state_registry(const std::string& name, std::size_t capacity) :
+        state_registry(name, capacity, create(name, capacity))
+    {}
+
+    ~state_registry() {
+        // unless the name has been unlinked and taken by another table since
+        int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_dev == created.dev && st.st_ino == created.ino) {
+            ::shm_unlink(name.c_str());
+        }
+        ::close(fd);
+    }
+
+    // id of a machine type with the given state names, registered on first use
+    std::uint32_t add_type(const std::string& machine, const std::vector<std::string>& states) {
+        std::lock_guard<std::mutex> g(m);
+        auto it = type_ids.find(machine);
+        if (it != type_ids.end()) {
+            return it->second;
+        }
+
+        auto& h = header();
+        auto t = h.types.load(std::memory_order_relaxed);
+        if (t == detail::registry_header::max_types || states.size() > detail::registry_header::max_states) {
+            throw std::length_error("state table cannot describe " + machine);
+        }
+
+        auto& entry = type(t);
+        detail::copy_name(entry.machine, machine);
+        entry.states = static_cast<std::uint32_t>(states.size());
+        for (std::size_t s = 0; s < states.size(); ++s) {
+            detail::copy_name(entry.state[s], states[s]);
+        }
+        h.types.store(t + 1, std::memory_order_release);
+        return type_ids[machine] = t + 1;
+    }
+
+    // a free slot, or nullptr when the table is full
+    std::atomic<std::uint32_t>* acquire() {
+        std::lock_guard<std::mutex> g(m);
+        if (!free.empty()) {
+            auto s = free.back();
+            free.pop_back();
+            return &slots()[s];
+        }
+
+        auto& h = header();
+        auto s = h.used.load(std::memory_order_relaxed);
+        if (s == h.capacity) {
+            return nullptr;
+        }
+        h.used.store(s + 1, std::memory_order_release);
+        return &slots()[s];
+    }
+
+    void release(std::atomic<std::uint32_t>* slot) {
+        slot->store(0, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> g(m);
+        free.push_back(static_cast<std::uint32_t>(slot - slots()));
+    }
+
+    std::size_t slot_of(const std::atomic<std::uint32_t>* slot) const noexcept {
+        return static_cast<std::size_t>(slot - slots());
+    }
+
+    const std::string& shm_name() const noexcept {
+        return name;
+    }
+private:
+    // the mapping and the identity of the shm object behind it
+    struct table_id {
+        void*   base;
+        dev_t   dev;
+        ino_t   ino;
+    };
+
+    state_registry(const std::string& name, std::size_t capacity, table_id created) :
+        state_table(created.base, detail::registry_size(capacity), true),
+        name(name),
+        created(created)
+    {
+        auto& h = header();
+        std::memcpy(h.magic, detail::registry_header::magic_value, sizeof(h.magic));
+        h.capacity = static_cast<std::uint32_t>(capacity);
+        h.pid = static_cast<std::uint32_t>(::getpid());
+    }
+
+    static table_id create(const std::string& name, std::size_t capacity) {
+        if (capacity == 0 || capacity > UINT32_MAX) {
+            throw std::invalid_argument("state_registry capacity out of range");
+        }
+
+        int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0) {
+            throw std::system_error(errno, std::system_category(), "shm_open " + name);
+        }
+
+        auto size = detail::registry_size(capacity);
+        struct stat st;
+        void* p = ::fstat(fd, &st) == 0 && ::ftruncate(fd, static_cast<off_t>(size)) == 0
+            ? ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+            : MAP_FAILED;
+        auto err = errno;
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            ::shm_unlink(name.c_str());
+            throw std::system_error(err, std::system_category(), "cannot map state table " + name);
+        }
+        return {p, st.st_dev, st.st_ino};
+    }
+
+    detail::registry_header& header() noexcept {
+        return *static_cast<detail::registry_header*>(base);
+    }
+
+    detail::registry_type& type(std::uint32_t t) noexcept {
+        return reinterpret_cast<detail::registry_type*>(static_cast<char*>(base) + sizeof(detail::registry_header))[t];
+    }
+private:
+    std::string                             name;
+    table_id                                created;
+    std::mutex                              m;
+    std::map<std::string, std::uint32_t>    type_ids;
+    std::vector<std::uint32_t>              free;
+}; // class state_registry
+
+// A machine's slot in a state_registry, released when the machine goes away.
+class monitor_slot {
+public:
+    monitor_slot() noexcept : registry(nullptr), cell(nullptr), type(0) {}
+
+    monitor_slot(state_registry& registry, std::uint32_t type) :
+        registry(&registry),
+        cell(registry.acquire()),
+        type(type)
+    {}
+
+    monitor_slot(monitor_slot&& other) noexcept :
+        registry(other.registry),
+        cell(std::exchange(other.cell, nullptr)),
+        type(other.type)
+    {}
+
+    monitor_slot& operator=(monitor_slot&& other) noexcept {
+        if (this != &other) {
+            reset();
+            registry = other.registry;
+            cell = std::exchange(other.cell, nullptr);
+            type = other.type;
+        }
+        return *this;
+    }
+
+    ~monitor_slot() {
+        reset();
+    }
+
+    void publish(std::size_t state_index) noexcept {
+        if (cell) {
+            cell->store(type << 16 | static_cast<std::uint32_t>(state_index), std::memory_order_relaxed);
+        }
+    }
+
+    explicit operator bool() const noexcept {
+        return cell != nullptr;
+    }
+
+    // index for state_table::state_of()
+    std::size_t index() const noexcept {
+        return cell ? registry->slot_of(cell) : SIZE_MAX;
+    }
+
+    void reset() noexcept {
+        if (cell) {
+            registry->release(std::exchange(cell, nullptr));
+        }
+    }
+private:
+    state_registry*                 registry;
+    std::atomic<std::uint32_t>*     cell;
+    std::uint32_t                   type;
+}; // class monitor_slot
+
+} // namespace afsm
@@ -0,0 +1,299 @@
+#pragma once
+
+// ours
+#include "state.hpp"
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace afsm {
+
+using periodic_clock = std::chrono::steady_clock;
+
+// what a cadence does when its owner falls behind by more than a period
+enum class overrun {
+    catch_up,   // deliver every missed deadline, back to back
+    skip        // continue with the next deadline in the future, report how many were missed
+};
+
+// one deadline of a cadence passed
+struct elapsed {
+    periodic_clock::time_point  deadline;
+    std::uint64_t               missed;     // deadlines skipped before this one
+};
+
+// Per io_service timers shared by everything waiting with the same period.
+// Deadlines of a period lie on one grid (multiples of the period from a
+// common origin), so all cadences of a period fire together from a single
+// timer; a period without waiters has no armed timer. Not thread safe, use
+// from the io_service's thread (or a strand) only.
+class period_scheduler : public asio::io_service::service {
+public:
+    static inline asio::io_service::id id;
+    using ticket = std::uint64_t;
+    using handler = std::function<void(const std::error_code&)>;
+
+    explicit period_scheduler(asio::io_service& io) :
+        asio::io_service::service(io),
+        io(io),
+        origin(periodic_clock::now()),
+        next_ticket(1)
+    {}
+
+    // first deadline of the period's grid after `t`
+    periodic_clock::time_point next_after(periodic_clock::duration period, periodic_clock::time_point t) const {
+        auto n = (t - origin) / period + 1;
+        return origin + n * period;
+    }
+
+    ticket wait(periodic_clock::duration period, periodic_clock::time_point deadline, handler h) {
+        auto& g = group_of(period);
+        auto t = next_ticket++;
+        g.due[deadline].push_back(waiter{t, std::move(h)});
+        arm(g);
+        return t;
+    }
+
+    // the handler is posted with operation_aborted
+    void cancel(periodic_clock::duration period, periodic_clock::time_point deadline, ticket t) {
+        if (auto w = take(period, deadline, t)) {
+            asio::post(io, [h = std::move(w)] { h(make_error_code(asio::error::operation_aborted)); });
+        }
+    }
+
+    // the handler is dropped without being called
+    void forget(periodic_clock::duration period, periodic_clock::time_point deadline, ticket t) {
+        take(period, deadline, t);
+    }
+private:
+    struct waiter {
+        ticket      id;
+        handler     fn;
+    };
+
+    struct group {
+        explicit group(asio::io_service& io) : timer(io), armed(periodic_clock::time_point::max()), generation(0) {}
+
+        asio::steady_timer                                          timer;
+        std::map<periodic_clock::time_point, std::vector<waiter>>   due;
+        periodic_clock::time_point                                  armed;
+        std::uint64_t                                               generation;
+    };
+
+    group& group_of(periodic_clock::duration period) {
+        auto& g = groups[period.count()];
+        if (!g) {
+            g = std::make_unique<group>(io);
+        }
+        return *g;
+    }
+
+    handler take(periodic_clock::duration period, periodic_clock::time_point deadline, ticket t) {
+        auto git = groups.find(period.count());
+        if (git == groups.end()) {
+            return nullptr;
+        }
+
+        auto& g = *git->second;
+        auto& due = g.due;
+        auto it = due.find(deadline);
+        if (it == due.end()) {
+            return nullptr;
+        }
+
+        auto& ws = it->second;
+        auto w = std::find_if(ws.begin(), ws.end(), [t](const waiter& w) { return w.id == t; });
+        if (w == ws.end()) {
+            return nullptr;
+        }
+
+        auto h = std::move(w->fn);
+        ws.erase(w);
+        if (ws.empty()) {
+            due.erase(it);
+        }
+        if (due.empty()) {
+            // nothing left to wait for, the io_service need not wait for the
+            // timer; its handler is stale, the next wait arms it again
+            g.armed = periodic_clock::time_point::max();
+            ++g.generation;
+            g.timer.cancel();
+        }
+        return h;
+    }
+
+    // keeps the timer on the earliest deadline of the group
+    void arm(group& g) {
+        if (g.due.empty() || g.due.begin()->first >= g.armed) {
+            return;
+        }
+
+        g.armed = g.due.begin()->first;
+        g.timer.expires_at(g.armed);
+        g.timer.async_wait([this, &g, gen = ++g.generation](const std::error_code& ec) {
+            if (gen != g.generation) {
+                return;     // re-armed for an earlier deadline meanwhile
+            }
+
+            g.armed = periodic_clock::time_point::max();
+            if (ec) {
+                return;
+            }
+            fire(g);
+        });
+    }
+
+    void fire(group& g) {
+        auto now = periodic_clock::now();
+        std::vector<waiter> ready;
+        while (!g.due.empty() && g.due.begin()->first <= now) {
+            auto& ws = g.due.begin()->second;
+            std::move(ws.begin(), ws.end(), std::back_inserter(ready));
+            g.due.erase(g.due.begin());
+        }
+
+        for (auto& w : ready) {
+            w.fn(std::error_code());
+        }
+        arm(g);
+    }
+
+    void shutdown() override {
+        groups.clear();
+    }
+private:
+    asio::io_service&                                       io;
+    periodic_clock::time_point                              origin;
+    std::map<periodic_clock::rep, std::unique_ptr<group>>   groups;
+    ticket                                                  next_ticket;
+}; // class period_scheduler
+
+// The absolute deadlines of one periodic activity. Every deadline is the
+// previous one plus the period, never "now plus the period", so time spent
+// between two waits (handlers, transitions) does not accumulate as drift.
+// Keep it where it outlives the states waiting on it, e.g. in the context.
+class cadence {
+public:
+    cadence(asio::io_service& io, periodic_clock::duration period, overrun policy = overrun::skip) :
+        sched(asio::use_service<period_scheduler>(io)),
+        period(period),
+        policy(policy),
+        pending(0)
+    {}
+
+    cadence(const cadence&) = delete;
+    cadence& operator=(const cadence&) = delete;
+
+    ~cadence() {
+        if (pending) {
+            sched.forget(period, next, pending);
+        }
+    }
+
+    // handler: void(const std::error_code&, const elapsed&), called when the
+    // next deadline passed; the first deadline is the next one of the
+    // period's grid
+    template<typename Handler>
+    void async_wait(Handler&& handler) {
+        if (next == periodic_clock::time_point()) {
+            next = sched.next_after(period, periodic_clock::now());
+        }
+
+        pending = sched.wait(period, next, [this, handler = std::forward<Handler>(handler)](const std::error_code& ec) mutable {
+            pending = 0;
+            if (ec) {
+                return handler(ec, elapsed{next, 0});
+            }
+            handler(ec, advance());
+        });
+    }
+
+    void cancel() {
+        if (pending) {
+            sched.cancel(period, next, std::exchange(pending, 0));
+        }
+    }
+
+    // forget the phase, the next wait starts on the next grid deadline
+    void reset() {
+        cancel();
+        next = periodic_clock::time_point();
+    }
+
+    periodic_clock::time_point next_deadline() const noexcept {
+        return next;
+    }
+
+    periodic_clock::duration interval() const noexcept {
+        return period;
+    }
+private:
+    elapsed advance() {
+        elapsed e{next, 0};
+        next += period;
+        if (policy == overrun::skip) {
+            auto now = periodic_clock::now();
+            if (next <= now) {
+                auto behind = static_cast<std::uint64_t>((now - next) / period) + 1;
+                e.missed = behind;
+                next += behind * period;
+            }
+        }
+        return e;
+    }
+private:
+    period_scheduler&               sched;
+    periodic_clock::duration        period;
+    overrun                         policy;
+    periodic_clock::time_point      next;
+    period_scheduler::ticket        pending;
+}; // class cadence
+
+// Waits for the next deadline of a cadence, then completes with Tick (built
+// from the elapsed deadline if Tick accepts one); Stopped when cancelled.
+//
+//   afsm::transition<sampling, sampled, periodic<sample_due, stopped>>,
+//   afsm::transition<periodic<sample_due, stopped>, sample_due, sampling>,
+template<typename Tick, typename Stopped>
+class periodic : public state<Tick, Stopped> {
+public:
+    periodic(asio::io_service& io, cadence& beat) :
+        state<Tick, Stopped>(io),
+        beat(beat)
+    {}
+
+    virtual void on_enter() override {
+        beat.async_wait(this->track([this](const std::error_code& ec, const elapsed& e) {
+            if (ec) {
+                return this->template complete<Stopped>();
+            }
+
+            if constexpr (std::is_constructible_v<Tick, const elapsed&>) {
+                this->template complete<Tick>(e);
+            } else {
+                this->template complete<Tick>();
+            }
+        }));
+    }
+
+    virtual void cancel() override {
+        this->template complete<Stopped>();
+        beat.cancel();
+    }
+private:
+    cadence& beat;
+}; // class periodic
+
+} // namespace afsm
@@ -0,0 +1,223 @@
+#pragma once
+
+// ours
+#include "detail/task.hpp"
+#include "util/scope_exit.hpp"
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+namespace afsm {
+
+enum class priority : int { low, normal, high, critical };
+
+inline constexpr std::size_t priority_levels = 4;
+
+// Per io_service set of priority queues. Handlers posted here are executed
+// highest priority first; after `starvation_limit` handlers in a row taken
+// from above a waiting lower level, one handler of the lower level is run.
+//
+// Priorities only apply while the io_service is driven by
+// priority_scheduler::run(): queued handlers above normal priority then
+// overtake the io_service's own FIFO. Under plain io_service::run() handlers
+// are posted to the io_service as they are, without a detour through the
+// queues.
+class priority_scheduler : public asio::io_service::service {
+public:
+    static inline asio::io_service::id id;
+
+    explicit priority_scheduler(asio::io_service& io) :
+        asio::io_service::service(io),
+        io(io),
+        starvation_limit(64),
+        streak(0),
+        drain_posted(false),
+        driven(false)
+    {}
+
+    void set_starvation_limit(std::size_t n) {
+        std::lock_guard<std::mutex> g(m);
+        starvation_limit = std::max<std::size_t>(n, 1);
+    }
+
+    template<typename Handler>
+    void post(priority p, Handler&& handler) {
+        if (!driven.load(std::memory_order_acquire)) {
+            asio::post(io, std::forward<Handler>(handler));
+            return;
+        }
+
+        std::lock_guard<std::mutex> g(m);
+        queues[static_cast<std::size_t>(p)].emplace_back(std::forward<Handler>(handler));
+        if (!std::exchange(drain_posted, true)) {
+            io.post([this] { drain(); });
+        }
+    }
+
+    // single threaded replacement of io_service::run(): queued handlers above
+    // normal priority run before any further io_service handler, the others
+    // alternate with the io_service's handlers one to one
+    std::size_t run() {
+        driven.store(true, std::memory_order_release);
+        // what is still queued on return is drained by the posted handler
+        util::scope_exit _([this] { driven.store(false, std::memory_order_release); });
+        std::size_t n = 0;
+        while (!io.stopped()) {
+            while (execute_one(priority::high)) {
+                ++n;
+            }
+
+            if (io.poll_one()) {
+                ++n;
+                n += execute_one(priority::low);
+            } else if (execute_one(priority::low)) {
+                ++n;
+            } else if (io.run_one()) {
+                ++n;
+            } else {
+                break;
+            }
+        }
+        return n;
+    }
+private:
+    void drain() {
+        {
+            std::lock_guard<std::mutex> g(m);
+            drain_posted = false;
+        }
+
+        // bounded, so the io_service gets to run its own handlers in between
+        for (std::size_t i = 0; i < 128 && execute_one(priority::low); ++i) {}
+
+        std::lock_guard<std::mutex> g(m);
+        if (!empty() && !std::exchange(drain_posted, true)) {
+            io.post([this] { drain(); });
+        }
+    }
+
+    // runs one handler of at least priority `min`
+    bool execute_one(priority min) {
+        detail::task t;
+        {
+            std::lock_guard<std::mutex> g(m);
+            auto top = highest(priority_levels);
+            if (top == priority_levels || top < static_cast<std::size_t>(min)) {
+                return false;
+            }
+
+            auto level = top;
+            auto lower = highest(top);
+            if (lower == priority_levels) {
+                streak = 0;
+            } else if (++streak > starvation_limit) {
+                streak = 0;
+                level = lower;
+            }
+            t = std::move(queues[level].front());
+            queues[level].pop_front();
+        }
+        t();
+        return true;
+    }
+
+    // highest non-empty level below `below`, priority_levels if none
+    std::size_t highest(std::size_t below) const {
+        for (auto i = below; i-- > 0;) {
+            if (!queues[i].empty()) {
+                return i;
+            }
+        }
+        return priority_levels;
+    }
+
+    bool empty() const {
+        return highest(priority_levels) == priority_levels;
+    }
+
+    void shutdown() override {
+        std::lock_guard<std::mutex> g(m);
+        for (auto& q : queues) {
+            q.clear();
+        }
+    }
+private:
+    asio::io_service&                                       io;
+    std::mutex                                              m;
+    std::array<std::deque<detail::task>, priority_levels>   queues;
+    std::size_t                                             starvation_limit;
+    std::size_t                                             streak;
+    bool                                                    drain_posted;
+    std::atomic<bool>                                       driven;     // inside run()
+}; // class priority_scheduler
+
+// executor submitting everything to one priority level of the scheduler,
+// usable with asio::post / asio::bind_executor
+class priority_executor {
+public:
+    priority_executor(asio::io_service& io, priority p) :
+        sched(&asio::use_service<priority_scheduler>(io)),
+        io(&io),
+        p(p)
+    {}
+
+    asio::io_service& context() const noexcept { return *io; }
+    void on_work_started() const noexcept { io->get_executor().on_work_started(); }
+    void on_work_finished() const noexcept { io->get_executor().on_work_finished(); }
+
+    template<typename F, typename Allocator>
+    void dispatch(F&& f, const Allocator& a) const {
+        post(std::forward<F>(f), a);
+    }
+
+    template<typename F, typename Allocator>
+    void post(F&& f, const Allocator&) const {
+        sched->post(p, std::forward<F>(f));
+    }
+
+    template<typename F, typename Allocator>
+    void defer(F&& f, const Allocator& a) const {
+        post(std::forward<F>(f), a);
+    }
+
+    priority level() const noexcept { return p; }
+
+    friend bool operator==(const priority_executor& a, const priority_executor& b) noexcept {
+        return a.sched == b.sched && a.p == b.p;
+    }
+
+    friend bool operator!=(const priority_executor& a, const priority_executor& b) noexcept {
+        return !(a == b);
+    }
+private:
+    priority_scheduler*     sched;
+    asio::io_service*       io;
+    priority                p;
+}; // class priority_executor
+
+namespace detail {
+
+// Traits::priority if the machine traits declare one
+template<typename Traits, typename = void>
+struct traits_priority {
+    static constexpr bool defined = false;
+};
+
+template<typename Traits>
+struct traits_priority<Traits, std::void_t<decltype(Traits::priority)>> {
+    static constexpr bool defined = true;
+    static constexpr afsm::priority value = Traits::priority;
+};
+
+} // namespace detail
+} // namespace afsm
@@ -0,0 +1,170 @@
+#pragma once
+
+// ours
+#include "state.hpp"
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace afsm {
+namespace detail {
+
+template<typename Variant>
+struct state_of;
+
+template<typename ...Events>
+struct state_of<std::variant<Events...>> {
+    using type = state<Events...>;
+};
+
+} // namespace detail
+
+// Orthogonal regions: a state running several state machines at the same
+// time. Each region is a complete machine with its own transition table;
+// regions may be placed on other io_services (threads) than the enclosing
+// machine, in which case everything touching a region is posted to it and its
+// result is posted back.
+//
+// Join decides when the regions state is done and with which event:
+//
+//   struct join {
+//       using result = std::variant<ok, failed>;
+//       // called whenever a region finishes, results is a
+//       // std::tuple<std::optional<Machines::result>...>
+//       template<typename Results>
+//       std::optional<result> operator()(const Results& results) const;
+//   };
+//
+// Once Join returns an event the regions still running are cancelled, Join
+// must return an event at the latest when every region has finished.
+// Cancelling the regions state cancels every region and lets Join map their
+// results.
+template<typename Join, typename ...Machines>
+class regions : public detail::state_of<typename Join::result>::type {
+private:
+    using base = typename detail::state_of<typename Join::result>::type;
+    static constexpr std::size_t size = sizeof...(Machines);
+public:
+    using results = std::tuple<std::optional<typename Machines::result>...>;
+
+    // io_service of each region
+    struct placement {
+        std::array<asio::io_service*, size> ios;
+    };
+private:
+    template<typename ...Args>
+    static constexpr bool placed() {
+        if constexpr (sizeof...(Args) == 0) {
+            return false;
+        } else {
+            return std::is_same_v<std::decay_t<std::tuple_element_t<0, std::tuple<Args...>>>, placement>;
+        }
+    }
+public:
+    // every region on the io_service of the enclosing machine, the arguments
+    // are passed to each region machine (see state_machine's constructor)
+    template<typename ...Args, typename = std::enable_if_t<!placed<Args...>()>>
+    regions(asio::io_service& io, Args&& ...args) :
+        base(io)
+    {
+        where.ios.fill(&io);
+        emplace(std::index_sequence_for<Machines...>{}, args...);
+    }
+
+    template<typename ...Args>
+    regions(asio::io_service& io, const placement& where, Args&& ...args) :
+        base(io),
+        where(where)
+    {
+        emplace(std::index_sequence_for<Machines...>{}, args...);
+    }
+
+    virtual void on_enter() override {
+        start(std::index_sequence_for<Machines...>{});
+    }
+
+    virtual void cancel() override {
+        cancel(std::index_sequence_for<Machines...>{});
+    }
+
+    const results& region_results() const noexcept {
+        return outcomes;
+    }
+private:
+    template<std::size_t ...I, typename ...Args>
+    void emplace(std::index_sequence<I...>, Args& ...args) {
+        (std::get<I>(machines).emplace(*where.ios[I], args...), ...);
+    }
+
+    template<std::size_t ...I>
+    void start(std::index_sequence<I...>) {
+        (start_region<I>(), ...);
+    }
+
+    template<std::size_t ...I>
+    void cancel(std::index_sequence<I...>) {
+        (cancel_region<I>(), ...);
+    }
+
+    bool local(std::size_t i) const {
+        return where.ios[i] == &this->io;
+    }
+
+    template<std::size_t I>
+    void start_region() {
+        using result_type = typename std::tuple_element_t<I, std::tuple<Machines...>>::result;
+        auto done = this->track([this](const result_type& r) {
+            std::get<I>(outcomes).emplace(r);
+            if (auto ev = Join{}(const_cast<const results&>(outcomes))) {
+                std::visit([this](auto&& e) {
+                    this->template complete<std::decay_t<decltype(e)>>(e);
+                }, *ev);
+            }
+        });
+
+        auto& m = *std::get<I>(machines);
+        if (local(I)) {
+            return m.async_wait(std::move(done));
+        }
+
+        // bound to the enclosing machine's io_service, the result is
+        // dispatched back there; the region keeps work on it once started
+        asio::post(*where.ios[I], [&m, done = asio::bind_executor(this->io, std::move(done)), work = asio::make_work_guard(this->io)]() mutable {
+            m.async_wait(std::move(done));
+        });
+    }
+
+    template<std::size_t I>
+    void cancel_region() {
+        if (std::get<I>(outcomes)) {
+            return;
+        }
+
+        auto& m = *std::get<I>(machines);
+        if (local(I)) {
+            return m.cancel();
+        }
+
+        // keeps this state alive until the region has seen the cancellation
+        auto done = this->track([] {});
+        asio::post(*where.ios[I], [this, &m, done = std::move(done)]() mutable {
+            m.cancel();
+            asio::post(this->io, std::move(done));
+        });
+    }
+private:
+    placement                                   where;
+    std::tuple<std::optional<Machines>...>      machines;
+    results                                     outcomes;
+}; // class regions
+
+} // namespace afsm
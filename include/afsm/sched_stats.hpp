@@ -0,0 +1,209 @@
+#pragma once
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+
+// 1 compiles timestamps into states and machines: how long a completed
+// state waited for its tracked handlers, for the executor and for the next
+// state to be built, per machine type. Changes the layout of state_base, so
+// it has to be the same in every translation unit.
+#ifndef AFSM_SCHED_STATS
+#define AFSM_SCHED_STATS 0
+#endif
+
+namespace afsm {
+
+inline constexpr bool sched_stats_enabled = AFSM_SCHED_STATS != 0;
+
+using sched_clock = std::chrono::steady_clock;
+
+// Values in power of two buckets, updated lock free from any number of
+// threads. Percentiles are the upper bound of their bucket.
+class log2_histogram {
+public:
+    static constexpr std::size_t buckets = 48;
+
+    void record(std::uint64_t v) noexcept {
+        n[bucket_of(v)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(v, std::memory_order_relaxed);
+        auto m = peak.load(std::memory_order_relaxed);
+        while (v > m && !peak.compare_exchange_weak(m, v, std::memory_order_relaxed)) {}
+    }
+
+    std::uint64_t count() const noexcept {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    double mean() const noexcept {
+        auto c = count();
+        return c ? static_cast<double>(sum.load(std::memory_order_relaxed)) / static_cast<double>(c) : 0.0;
+    }
+
+    std::uint64_t max() const noexcept {
+        return peak.load(std::memory_order_relaxed);
+    }
+
+    // p in [0, 1]
+    std::uint64_t percentile(double p) const noexcept {
+        auto c = count();
+        if (c == 0) {
+            return 0;
+        }
+
+        auto rank = static_cast<std::uint64_t>(p * static_cast<double>(c - 1)) + 1;
+        std::uint64_t seen = 0;
+        for (std::size_t b = 0; b < buckets; ++b) {
+            seen += n[b].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return std::min(b == 0 ? 0 : (std::uint64_t(1) << b) - 1, max());
+            }
+        }
+        return max();
+    }
+private:
+    // bucket b holds [2^(b-1), 2^b)
+    static std::size_t bucket_of(std::uint64_t v) noexcept {
+        std::size_t b = 0;
+        while (v && b < buckets - 1) {
+            v >>= 1;
+            ++b;
+        }
+        return b;
+    }
+private:
+    std::array<std::atomic<std::uint64_t>, buckets>     n{};
+    std::atomic<std::uint64_t>                          total{0};
+    std::atomic<std::uint64_t>                          sum{0};
+    std::atomic<std::uint64_t>                          peak{0};
+}; // class log2_histogram
+
+// Durations, kept as nanoseconds.
+class latency_histogram {
+public:
+    void record(sched_clock::duration d) noexcept {
+        values.record(static_cast<std::uint64_t>(std::max<sched_clock::rep>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count(), 0)));
+    }
+
+    std::uint64_t count() const noexcept {
+        return values.count();
+    }
+
+    std::chrono::nanoseconds mean() const noexcept {
+        return std::chrono::nanoseconds(static_cast<std::uint64_t>(values.mean()));
+    }
+
+    std::chrono::nanoseconds max() const noexcept {
+        return std::chrono::nanoseconds(values.max());
+    }
+
+    // p in [0, 1]
+    std::chrono::nanoseconds percentile(double p) const noexcept {
+        return std::chrono::nanoseconds(values.percentile(p));
+    }
+private:
+    log2_histogram values;
+}; // class latency_histogram
+
+// Scheduling delays of one machine type, between a state's complete<>()
+// and the next state's on_enter():
+//
+//   complete<>() -drain-> last tracked handler returns, result posted
+//                -queue-> machine's on_event() runs
+//                -construct-> next state built, its on_enter() starts
+struct sched_stats {
+    latency_histogram   drain;
+    latency_histogram   queue;
+    latency_histogram   construct;
+};
+
+// The sched_stats of every machine type that transitioned so far.
+class sched_stats_registry {
+public:
+    static sched_stats_registry& instance() {
+        static sched_stats_registry r;
+        return r;
+    }
+
+    sched_stats& add(const std::string& machine) {
+        std::lock_guard<std::mutex> g(m);
+        for (auto& [name, stats] : types) {
+            if (name == machine) {
+                return stats;
+            }
+        }
+        return types.emplace_back(std::piecewise_construct, std::forward_as_tuple(machine), std::forward_as_tuple()).second;
+    }
+
+    // f(const std::string& machine, const sched_stats&)
+    template<typename F>
+    void for_each(F&& f) const {
+        std::lock_guard<std::mutex> g(m);
+        for (auto& [name, stats] : types) {
+            f(name, stats);
+        }
+    }
+private:
+    mutable std::mutex                                  m;
+    std::deque<std::pair<std::string, sched_stats>>     types;  // stable addresses
+}; // class sched_stats_registry
+
+// Per io_service count of state completions posted and not yet picked up
+// by their machine. Each completion records how many were waiting when it
+// was posted, so the histogram is the queue as the completions found it;
+// a periodic sample would itself wait behind that queue and mostly find it
+// drained. Handlers posted by anything else are not counted.
+class queue_depth : public asio::io_service::service {
+public:
+    static inline asio::io_service::id id;
+
+    explicit queue_depth(asio::io_service& io) : asio::io_service::service(io), pending(0) {}
+
+    void posted() noexcept {
+        auto waiting = pending.fetch_add(1, std::memory_order_relaxed);
+        ahead.record(static_cast<std::uint64_t>(std::max<std::int64_t>(waiting, 0)));
+    }
+
+    void picked_up() noexcept {
+        pending.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    std::int64_t current() const noexcept {
+        return pending.load(std::memory_order_relaxed);
+    }
+
+    // completions already waiting whenever one was posted
+    const log2_histogram& found_on_post() const noexcept {
+        return ahead;
+    }
+private:
+    void shutdown() override {}
+private:
+    std::atomic<std::int64_t>   pending;
+    log2_histogram              ahead;
+}; // class queue_depth
+
+namespace detail {
+
+// what a state remembers of its own completion
+struct sched_stamps {
+    sched_clock::time_point     completed;
+    sched_clock::time_point     posted;
+    queue_depth*                depth = nullptr;
+};
+
+} // namespace detail
+} // namespace afsm
@@ -1,5 +1,8 @@
 #pragma once
 
+#include "priority_scheduler.hpp"
+#include "sched_stats.hpp"
+#include "detail/stored_handler.hpp"
 #include "util/scope_exit.hpp"
 
 // thirdparty
@@ -8,41 +11,122 @@
 // std
 #include <functional>
 #include <optional>
+#include <utility>
 #include <variant>
 
 namespace afsm {
 
 class state_base {
 public:
-    state_base(asio::io_service& io) : io(io) {}
+    state_base(asio::io_service& io) : io(io), scheduler(nullptr), prio(priority::normal) {}
     virtual void cancel() = 0;
     virtual ~state_base()  = default;
+
+    // the completion of this state is queued by priority instead of being
+    // posted to the io_service directly, see priority_scheduler::run()
+    void prioritize(priority p) {
+        scheduler = &asio::use_service<priority_scheduler>(io);
+        prio = p;
+    }
+
+    bool prioritized() const noexcept {
+        return scheduler != nullptr;
+    }
+
+#if AFSM_SCHED_STATS
+    // the completion of this state is counted in `depth` while queued
+    void instrument(queue_depth* depth) noexcept {
+        stamps.depth = depth;
+    }
+
+    const detail::sched_stamps& sched() const noexcept {
+        return stamps;
+    }
+#endif
+protected:
+    template<typename Handler>
+    void post(Handler&& handler) {
+        if (scheduler) {
+            scheduler->post(prio, std::forward<Handler>(handler));
+        } else {
+            asio::post(io, std::forward<Handler>(handler));
+        }
+    }
 protected:
     asio::io_service&       io;
+    priority_scheduler*     scheduler;
+    priority                prio;
+#if AFSM_SCHED_STATS
+    detail::sched_stamps    stamps;
+#endif
 }; // class state_base
 
 template<typename ...Events>
 class state : public state_base {
 public:
     using result = std::variant<Events...>;
-    using completion_handler = std::function<void(const result&)>;
+    using completion_handler = detail::stored_handler<result>;
     state(asio::io_service& io) : state_base(io), rc(0) {}
 
-    void async_wait(completion_handler cb) {
-        if (this->cb) {
-            throw std::runtime_error("state is already active");
-        }
+    // Enters the state, completes with the event it completed with. Takes
+    // any completion token, see state_machine::async_wait().
+    template<typename CompletionToken>
+    auto async_wait(CompletionToken&& token) {
+        return asio::async_initiate<CompletionToken, void(result)>([this](auto handler) {
+            if (cb) {
+                throw std::runtime_error("state is already active");
+            }
 
-        this->cb = std::move(cb);
-        on_enter();
+#if AFSM_ASIO_CANCELLATION
+            auto slot = asio::get_associated_cancellation_slot(handler);
+            if (slot.is_connected()) {
+                slot.assign([this](asio::cancellation_type) { cancel(); });
+            }
+#endif
+            cb = completion_handler(std::move(handler));
+            // tracked, so a state may complete synchronously from on_enter()
+            track([this] { on_enter(); })();
+        }, token);
     }
 
     virtual void on_enter() = 0;
     virtual ~state() override = default;
 
+    // Stops the state's operations without completing it (on_suspend()), then
+    // posts `idle` once no tracked handler is left. This is how a state is
+    // moved to another io_service, see state_machine::migrate(). A state
+    // completing meanwhile completes as usual and `idle` is dropped. Does
+    // nothing and returns false unless the state is active().
+    bool suspend(std::function<void()> idle) {
+        if (!active()) {
+            return false;
+        }
+
+        suspended = std::move(idle);
+        track([this] { on_suspend(); })();
+        return true;
+    }
+
+    // cancels the state's operations like cancel(), without completing
+    virtual void on_suspend() {}
+
+    // entered, neither completing nor suspended; no new operation may be
+    // tracked otherwise
+    bool active() const noexcept {
+        return cb && !res && !suspended;
+    }
+
+    // suspend() was called, its operations have not stopped yet
+    bool suspending() const noexcept {
+        return cb && !res && suspended;
+    }
+
     template<typename V, typename ...Args>
     void complete(Args&& ...args) {
         if (!res) {
+#if AFSM_SCHED_STATS
+            stamps.completed = sched_clock::now();
+#endif
             res.emplace(std::in_place_type<V>, std::forward<Args>(args)...);
             cancel();
         }
@@ -53,11 +137,23 @@ public:
         ++rc;
         return [this, callable = std::forward<Callable>(callable)](auto&&... args) -> decltype(auto) {
             util::scope_exit _([this] {
+                // an idle state without result keeps waiting for the next operation
                 if (--rc == 0) {
-                    if (cb) {
-                        io.post(std::bind(*cb, *res));
-                        cb = std::nullopt;
+                    if (cb && res) {
+#if AFSM_SCHED_STATS
+                        stamps.posted = sched_clock::now();
+                        if (stamps.depth) {
+                            stamps.depth->posted();
+                        }
+#endif
+                        post([cb = std::move(cb), r = std::move(*res)]() mutable {
+                            cb(std::move(r));
+                        });
                         res = std::nullopt;
+                        suspended = nullptr;
+                    } else if (suspended) {
+                        post(std::exchange(suspended, nullptr));
+                        cb.reset();
                     }
                 }
             });
@@ -65,8 +161,9 @@ public:
         };
     }
 private:
-    std::optional<completion_handler>       cb;
+    completion_handler                      cb;
     std::optional<result>                   res;
+    std::function<void()>                   suspended;
     size_t                                  rc;
 }; // class state
 
@@ -5,9 +5,18 @@
 #include "transitions.hpp"
 #include "result_factory.hpp"
 #include "state_factory.hpp"
+#include "context_rehome.hpp"
+#include "checkpoint.hpp"
 #include "detail/end_of_list.hpp"
 #include "detail/state_machine_assertions.hpp"
 #include "detail/state_holder.hpp"
+#include "detail/is_variant.hpp"
+#include "detail/stored_handler.hpp"
+#include "state.hpp"
+#include "log.hpp"
+#include "monitor.hpp"
+#include "priority_scheduler.hpp"
+#include "sched_stats.hpp"
 #include "util/type_name.hpp"
 #include "util/contains.hpp"
 
@@ -15,10 +24,17 @@
 #include <asio.hpp>
 
 // std
+#include <atomic>
+#include <cstddef>
 #include <exception>
 #include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
 #include <type_traits>
+#include <utility>
 #include <variant>
+#include <vector>
 
 namespace afsm {
 
@@ -32,44 +48,150 @@ public:
     using end_state = typename Traits::end_state;
     using context = typename Traits::context;
     using result = typename Traits::result;
-    using completion_handler = std::function<void(const result&)>;
+    using completion_handler = detail::stored_handler<result>;
     using transition_table = typename Traits::transitions;
     using state_storage = typename detail::state_holder<std::variant<std::monostate, start_state>, transition_table>::type;
 
-    state_machine(asio::io_service& io) : io(io) {}
+    static constexpr bool migratable = std::is_invocable_v<context_rehome<context>, context&, asio::io_service&>;
 
-    template<typename ...Args2>
-    void async_wait(completion_handler cb, Args2&& ...args) {
-        if (sess) {
-            throw std::runtime_error("state machine already active");
-        }
+    state_machine(asio::io_service& io) : io(&io), moving(nullptr), cancel_deferred(false), resuming(false) {}
 
-        sess.emplace(io, std::move(cb), std::forward<Args2>(args)...);
-        auto& active_state = sess->active_state();
-        std::apply([&](auto&& ...args2) {
-            active_state.template emplace<start_state>(std::forward<decltype(args2)>(args2)...);
-        }, state_factory<start_state, std::monostate, context>{}(std::monostate{}, sess->ctx));
-        std::visit([&](auto&& s) {
-            using T = std::decay_t<decltype(s)>;
-            if constexpr (std::is_same<T, start_state>()) {
-                s.async_wait(std::bind(&state_machine::on_event<start_state, typename start_state::result>, this, std::placeholders::_1));
+    // Prepares the context up front, async_wait() then starts the machine
+    // without arguments. This is how a machine is built when it is used as
+    // a state of another machine: state_factory passes (io, event, ...).
+    template<typename Arg, typename ...Args2>
+    state_machine(asio::io_service& io, Arg&& arg, Args2&& ...args) : io(&io), moving(nullptr), cancel_deferred(false), resuming(false) {
+        sess.emplace(io, completion_handler(), std::forward<Arg>(arg), std::forward<Args2>(args)...);
+    }
+
+    // Starts the machine, completes with its result. Any completion token
+    // works (a callback, asio::use_future, use_awaitable, ...): the handler
+    // runs on its associated executor (directly when it has none), is stored
+    // with its associated allocator unless small, and its cancellation slot
+    // (asio 1.19 on) cancels the machine. `args` construct the context;
+    // tokens deferring the start take them by value, std::ref passes a
+    // reference.
+    template<typename CompletionToken, typename ...Args2>
+    auto async_wait(CompletionToken&& token, Args2&& ...args) {
+        return asio::async_initiate<CompletionToken, void(result)>([this](auto handler, auto&& ...args2) {
+#if AFSM_ASIO_CANCELLATION
+            auto slot = asio::get_associated_cancellation_slot(handler);
+            if (slot.is_connected()) {
+                slot.assign([this](asio::cancellation_type) { cancel(); });
             }
-        }, active_state);
+#endif
+            start(completion_handler(std::move(handler)), std::forward<decltype(args2)>(args2)...);
+        }, token, std::forward<Args2>(args)...);
     }
 
+    // Call from the io_service the machine is on, see post_cancel() for
+    // other threads.
     void cancel() {
         if (!sess) {
             return;
         }
 
-        std::visit([](auto&& s) {
+        std::visit([this](auto&& s) {
             using T = std::decay_t<decltype(s)>;
             if constexpr (!std::is_same_v<std::monostate, T> && !std::is_same_v<end_state, T>) {
-                s.cancel();
+                cancel_state(s);
             }
         }, sess->active_state());
     }
 
+    // cancel() from any thread: it runs on the io_service the machine is on
+    // by then and follows the machine there if it migrated in the meantime.
+    // The machine must outlive it.
+    void post_cancel() {
+        asio::io_service* on = io;
+        asio::post(*on, [this, on] {
+            if (io != on) {
+                return post_cancel();
+            }
+
+            if (moving == on) {
+                // the machine arrived but the old io_service may still be
+                // handing it over, its first handler here applies the cancel
+                cancel_deferred = true;
+                return;
+            }
+            cancel();
+        });
+    }
+
+    // Moves the machine to `to` at a safe point, between states: right away
+    // when idle; as soon as the active state's operations stopped when it
+    // can be continued on another io_service (an (io_service&, State&&)
+    // constructor and on_suspend()); otherwise when it completes. The context
+    // is re-homed with context_rehome, states built from then on get `to`.
+    //
+    // Call from the machine's io_service; `done` runs on `to` once the machine
+    // is there. cancel() still reaches the state until it leaves, only a
+    // cancel() landing while the machine is between the two io_services is
+    // deferred to the state it continues with. get_io_service() is `to` from
+    // the moment the machine leaves, before its first handler runs there.
+    // Nested machines move along with their enclosing machine's state, not
+    // on their own.
+    void migrate(asio::io_service& to, std::function<void()> done = {}) {
+        static_assert(migratable, "the context can not be re-homed, see context_rehome");
+        if (moving) {
+            throw std::runtime_error("state machine already migrating");
+        }
+
+        if (!sess || sess->active_state().index() == 0 || &to == io) {
+            if (sess) {
+                context_rehome<context>{}(sess->ctx, to);
+            }
+            io = &to;
+            reset_instruments();
+            if (done) {
+                asio::post(to, std::move(done));
+            }
+            return;
+        }
+
+        moving = &to;
+        moved = std::move(done);
+        // a state that can not be suspended (completing already, its event
+        // queued) is left to on_event()
+        std::visit([this](auto&& s) {
+            using T = std::decay_t<decltype(s)>;
+            if constexpr (std::is_base_of_v<state_base, T> && std::is_constructible_v<T, asio::io_service&, T&&>) {
+                s.suspend([this] { move_state<T>(); });
+            }
+        }, sess->active_state());
+    }
+
+    asio::io_service& get_io_service() const noexcept {
+        return *io;
+    }
+
+    // Publishes the active state into `registry` from now on, readable from
+    // other threads and processes without touching the machine. The registry
+    // must outlive the machine. Returns the machine's slot in the table, or
+    // SIZE_MAX when the table is full.
+    std::size_t monitor(state_registry& registry) {
+        slot = monitor_slot(registry, registry.add_type(util::type_name<state_machine>(), state_names()));
+        slot.publish(sess ? sess->active_state().index() : 0);
+        return slot.index();
+    }
+
+    // Records the active state into record `index` of `file` from now on,
+    // through state_checkpoint, for resuming after a restart. The next
+    // async_wait() resumes the state found in the record, if any: the context
+    // is built from the async_wait() arguments as usual, then the recorded
+    // state from state_checkpoint::restore() instead of the start state. The
+    // file must outlive the machine, every machine needs a record of its own.
+    void checkpoint(checkpoint_file& file, std::size_t index) {
+        record = checkpoint_slot(file, index);
+        resuming = true;
+    }
+
+    // names of the states, indexed like the state storage; 0 is idle
+    static std::vector<std::string> state_names() {
+        return state_names(std::make_index_sequence<std::variant_size_v<state_storage>>{});
+    }
+
     template<typename Visitor>
     static void static_visit(Visitor& visitor) {
         visit<Visitor, transition_table>{}(visitor);
@@ -116,27 +238,274 @@ private:
 
         completion_handler              cb;
         context                         ctx;
-        // std::unique_ptr<state_base>     st;
         state_storage                   st1;
         state_storage                   st2;
         bool                            holder1_active;
     };
     using opt_session = std::optional<session>;
 
+    // Called from on_event(), which already runs in a handler of its own, so
+    // the result is handed over without another post. The handler may destroy
+    // this machine (e.g. when it is a state of an enclosing machine), nothing
+    // is touched after invoking it.
     void complete(result r) {
+        cancel_deferred = false;
         if (sess) {
-            io.post(std::bind(sess->cb, std::move(r)));
+            auto cb = std::move(sess->cb);
             sess = std::nullopt;
+            slot.publish(0);
+            if (record) {
+                record.clear();
+            }
+            cb(std::move(r));
+        }
+    }
+
+    template<std::size_t ...I>
+    static std::vector<std::string> state_names(std::index_sequence<I...>) {
+        std::vector<std::string> names{util::type_name<std::variant_alternative_t<I, state_storage>>()...};
+        names[0] = "idle";
+        return names;
+    }
+
+    // states inherit the priority of the machine unless they chose their own
+    template<typename State>
+    static void prioritize(State& s) {
+        if constexpr (detail::traits_priority<Traits>::defined && std::is_base_of_v<state_base, State>) {
+            if (!s.prioritized()) {
+                s.prioritize(detail::traits_priority<Traits>::value);
+            }
+        }
+    }
+
+    // results of nested machines need not be variants, a plain result is a
+    // single event of the enclosing machine
+    template<typename Visitor, typename Event>
+    static void visit_event(Visitor&& visitor, const Event& ev) {
+        if constexpr (detail::is_variant<Event>::value) {
+            std::visit(std::forward<Visitor>(visitor), ev);
+        } else {
+            visitor(ev);
+        }
+    }
+
+#if AFSM_SCHED_STATS
+    static sched_stats& sched() {
+        static sched_stats& stats = sched_stats_registry::instance().add(util::type_name<state_machine>());
+        return stats;
+    }
+
+    // completion and queueing delay of the state that just completed
+    template<typename State>
+    void record_wait(sched_clock::time_point picked_up) {
+        if constexpr (std::is_base_of_v<state_base, State>) {
+            auto& stamps = std::get<State>(sess->active_state()).sched();
+            if (stamps.depth) {
+                stamps.depth->picked_up();
+            }
+            sched().drain.record(stamps.posted - stamps.completed);
+            sched().queue.record(picked_up - stamps.posted);
+        }
+    }
+#endif
+
+    template<typename State>
+    void instrument([[maybe_unused]] State& s) {
+#if AFSM_SCHED_STATS
+        if constexpr (std::is_base_of_v<state_base, State>) {
+            if (!depth) {
+                depth = &asio::use_service<queue_depth>(*io);
+            }
+            s.instrument(depth);
         }
+#endif
+    }
+
+    template<typename ...Args2>
+    void start(completion_handler cb, Args2&& ...args) {
+        if (sess && sess->cb) {
+            throw std::runtime_error("state machine already active");
+        }
+
+        if (!sess || sizeof...(Args2) > 0) {
+            // a nested machine's context may only be built from its event
+            if constexpr (std::is_constructible_v<context, asio::io_service&, Args2&&...>) {
+                sess.emplace(*io, std::move(cb), std::forward<Args2>(args)...);
+            } else {
+                throw std::logic_error("the context of the state machine needs constructor arguments");
+            }
+        } else {
+            sess->cb = std::move(cb);
+        }
+
+        if (std::exchange(resuming, false) && resume()) {
+            return;
+        }
+
+        auto& active_state = sess->active_state();
+        std::apply([&](auto&& ...args2) {
+            active_state.template emplace<start_state>(std::forward<decltype(args2)>(args2)...);
+        }, state_factory<start_state, std::monostate, context>{}(std::monostate{}, sess->ctx));
+        slot.publish(active_state.index());
+        std::visit([&](auto&& s) {
+            using T = std::decay_t<decltype(s)>;
+            if constexpr (std::is_same<T, start_state>()) {
+                prioritize(s);
+                instrument(s);
+                save_checkpoint(s);
+                s.async_wait(event_handler<start_state>());
+            }
+        }, active_state);
+    }
+
+    // enters the state recorded in the checkpoint instead of the start state
+    bool resume() {
+        if (auto saved = record.template load<state_machine>()) {
+            return resume(*saved, std::make_index_sequence<std::variant_size_v<state_storage>>{});
+        }
+        return false;
+    }
+
+    template<std::size_t ...I>
+    bool resume(checkpoint_slot::saved& saved, std::index_sequence<I...>) {
+        return (resume_in<std::variant_alternative_t<I, state_storage>>(saved) || ...);
+    }
+
+    template<typename State>
+    bool resume_in(checkpoint_slot::saved& saved) {
+        if constexpr (std::is_base_of_v<state_base, State> && detail::checkpoint_restores<State, context>::value) {
+            if (saved.state != detail::checkpoint_id<State>()) {
+                return false;
+            }
+
+            // a record the serializer can not read (written by another
+            // version of it, say) or can not rebuild the state from (an
+            // address that no longer parses) starts the machine over
+            using args_type = decltype(state_checkpoint<State, context>{}.restore(saved.reader, sess->ctx));
+            std::optional<args_type> args;
+            try {
+                args.emplace(state_checkpoint<State, context>{}.restore(saved.reader, sess->ctx));
+            } catch (const std::exception& e) {
+                AFSM_LOG_WARN("cannot resume {}, starting over: {}", util::lazy_type_name_of<State>(), e.what());
+                return false;
+            }
+
+            auto& active_state = sess->active_state();
+            auto& s = std::apply([&](auto&& ...args2) -> State& {
+                return active_state.template emplace<State>(std::forward<decltype(args2)>(args2)...);
+            }, std::move(*args));
+            slot.publish(active_state.index());
+            prioritize(s);
+            instrument(s);
+            save_checkpoint(s);
+            s.async_wait(event_handler<State>());
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    // the state just entered is the one to resume from now on
+    template<typename State>
+    void save_checkpoint(const State& s) {
+        if (record) {
+            record.template save<state_machine>(s, sess->ctx);
+        }
+    }
+
+    // resumes the machine with the result of `State`
+    template<typename State>
+    auto event_handler() {
+        return [this](const typename State::result& r) {
+            on_event<State>(r);
+        };
+    }
+
+    // the machine's own references to the io_service it leaves
+    void arrive() {
+        context_rehome<context>{}(sess->ctx, *moving);
+        io = moving;
+        reset_instruments();
+    }
+
+    // runs on the new io_service, before the machine continues there
+    void settle() {
+        moving = nullptr;
+        if (moved) {
+            std::exchange(moved, nullptr)();
+        }
+    }
+
+    // the suspended state is rebuilt on the new io_service from the old one
+    template<typename State>
+    void move_state() {
+        arrive();
+        auto& old_state = sess->active_state();
+        sess->holder1_active = !sess->holder1_active;
+        auto& s = sess->active_state().template emplace<State>(*io, std::move(std::get<State>(old_state)));
+        old_state = std::monostate{};
+        asio::post(*io, [this, &s] {
+            settle();
+            prioritize(s);
+            instrument(s);
+            s.async_wait(event_handler<State>());
+            apply_deferred_cancel(s);
+        });
+    }
+
+    template<typename State>
+    void apply_deferred_cancel(State& s) {
+        if (std::exchange(cancel_deferred, false)) {
+            cancel_state(s);
+        }
+    }
+
+    // A state that is neither running nor stopping its operations is between
+    // two states: it completed and its event is queued, or (migrating) it is
+    // on its way to the new io_service. It would ignore cancel(), so the
+    // state it leads to is cancelled on entry instead; a cancelled state that
+    // completes into another one has been cancelled already.
+    template<typename State>
+    void cancel_state(State& s) {
+        if constexpr (std::is_base_of_v<state_base, State>) {
+            if (!s.active() && !s.suspending()) {
+                cancel_deferred = true;
+                return;
+            }
+        }
+        s.cancel();
+    }
+
+    void reset_instruments() {
+#if AFSM_SCHED_STATS
+        depth = nullptr;
+#endif
     }
 
     template<typename State, typename Event>
     void on_event(const Event& ev) {
-        std::visit([this](auto v) {
+        if constexpr (migratable) {
+            if (moving) {
+                // safe point: the state completed, the next one is built on
+                // the new io_service (the old one is still alive for the event)
+                arrive();
+                asio::post(*io, [this, ev] {
+                    settle();
+                    on_event<State>(ev);
+                });
+                return;
+            }
+        }
+
+#if AFSM_SCHED_STATS
+        auto picked_up = sched_clock::now();
+        record_wait<State>(picked_up);
+#endif
+        visit_event([&](auto v) {
             using event_type = std::decay_t<decltype(v)>;
             transition_table::template assert_match<State, event_type>();
             using next_state_type = typename transition_table::template next_state<State, event_type>;
-            // log("{} + {} => {}", type_name<State>(), type_name<event_type>(), type_name<next_state_type>());
+            AFSM_LOG_TRACE("{} + {} => {}", util::lazy_type_name_of<State>(), util::lazy_type_name_of<event_type>(), util::lazy_type_name_of<next_state_type>());
             if constexpr (!std::is_same_v<next_state_type, end_state>) {
                 auto& old_state = sess->active_state();
                 // creating the new state
@@ -145,11 +514,19 @@ private:
                 std::apply([&](auto&& ...args2) {
                     active_state.template emplace<next_state_type>(std::forward<decltype(args2)>(args2)...);
                 }, state_factory<next_state_type, event_type, context>{}(v, sess->ctx));
+                slot.publish(active_state.index());
                 // invoking async_wait on the new state
                 std::visit([&](auto&& s) {
                     using T = std::decay_t<decltype(s)>;
                     if constexpr (std::is_same_v<T, next_state_type> && !std::is_same_v<T, end_state>) {
-                        s.async_wait(std::bind(&state_machine::on_event<next_state_type, typename next_state_type::result>, this, std::placeholders::_1));
+                        prioritize(s);
+                        instrument(s);
+                        save_checkpoint(s);
+#if AFSM_SCHED_STATS
+                        sched().construct.record(sched_clock::now() - picked_up);
+#endif
+                        s.async_wait(event_handler<next_state_type>());
+                        apply_deferred_cancel(s);
                     }
                 }, active_state);
                 // throwing away the old state
@@ -160,8 +537,17 @@ private:
         }, ev);
     }
 private:
-    asio::io_service&   io;
-    opt_session         sess;
+    std::atomic<asio::io_service*>  io;             // also read by post_cancel()
+    opt_session                     sess;
+    monitor_slot                    slot;
+    asio::io_service*               moving;         // migrating to
+    std::function<void()>           moved;
+    bool                            cancel_deferred;
+    checkpoint_slot                 record;
+    bool                            resuming;       // record not consumed yet
+#if AFSM_SCHED_STATS
+    queue_depth*                    depth = nullptr;
+#endif
 }; // state_machine
 
 } // namespace afsm
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+namespace afsm {
+namespace util {
+
+// "decorrelated jitter" backoff: every delay is drawn uniformly between the
+// base and three times the previous delay, capped. Machines failing at the
+// same moment therefore spread out instead of retrying in lockstep.
+class decorrelated_jitter {
+public:
+    using duration = std::chrono::milliseconds;
+
+    explicit decorrelated_jitter(duration base = std::chrono::milliseconds(100), duration cap = std::chrono::seconds(16)) :
+        base(base),
+        cap(cap),
+        prev(base)
+    {}
+
+    duration next() {
+        // prev * 3 may not even fit when the cap is near duration::max()
+        auto hi = std::max(base.count(), prev.count() > cap.count() / 3 ? cap.count() : prev.count() * 3);
+        std::uniform_int_distribution<duration::rep> dist(base.count(), hi);
+        prev = duration(dist(engine()));
+        return prev;
+    }
+
+    void reset() {
+        prev = base;
+    }
+private:
+    static std::minstd_rand& engine() {
+        thread_local std::minstd_rand e(std::random_device{}());
+        return e;
+    }
+private:
+    duration    base;
+    duration    cap;
+    duration    prev;
+}; // class decorrelated_jitter
+
+} // namespace util
+} // namespace afsm
@@ -0,0 +1,31 @@
+#pragma once
+
+// std
+#include <chrono>
+#include <ctime>
+
+namespace afsm {
+namespace util {
+
+// wall clock backed by CLOCK_REALTIME_COARSE where available: a few ms
+// resolution, but served from the vDSO without touching the hardware clock
+struct coarse_clock {
+    using duration = std::chrono::system_clock::duration;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::system_clock::time_point;
+    static constexpr bool is_steady = false;
+
+    static time_point now() noexcept {
+#ifdef CLOCK_REALTIME_COARSE
+        timespec ts;
+        ::clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        return time_point(std::chrono::duration_cast<duration>(std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec)));
+#else
+        return std::chrono::system_clock::now();
+#endif
+    }
+};
+
+} // namespace util
+} // namespace afsm
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <type_traits>
+#include <variant>
 
 namespace afsm {
 namespace util {
@@ -11,5 +12,14 @@ struct contains {
     static constexpr bool value {(std::is_same_v<What, Args> || ...)};
 };
 
+// returns a constexpr true if the alternatives of Variant contain What
+template<typename What, typename Variant>
+struct variant_contains {
+    static constexpr bool value {false};
+};
+
+template<typename What, typename ...Args>
+struct variant_contains<What, std::variant<Args...>> : contains<What, Args...> {};
+
 } // namespace util
 } // namespace afsm
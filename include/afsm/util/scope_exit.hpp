@@ -1,5 +1,7 @@
 #pragma once
 
+#include <utility>
+
 namespace afsm {
 namespace util {
 
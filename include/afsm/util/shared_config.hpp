@@ -0,0 +1,58 @@
+#pragma once
+
+// std
+#include <atomic>
+#include <memory>
+#include <utility>
+
+namespace afsm {
+namespace util {
+
+// Immutable configuration shared by a fleet of machines. Contexts keep a
+// reference to it (or a snapshot, 16 bytes) instead of their own copies;
+// a reload swaps in a new version atomically, machines pick it up the next
+// time they take a snapshot while the old version lives on until its last
+// snapshot is dropped.
+//
+//   util::shared_config<settings> cfg(settings{"example.com", "443"});
+//   auto s = cfg.load();                    // from any thread
+//   cfg.update([](settings& s) { s.service = "8443"; });
+template<typename T>
+class shared_config {
+public:
+    using snapshot = std::shared_ptr<const T>;
+
+    explicit shared_config(T initial) :
+        current(std::make_shared<const T>(std::move(initial)))
+    {}
+
+    shared_config(const shared_config&) = delete;
+    shared_config& operator=(const shared_config&) = delete;
+
+    snapshot load() const {
+        return std::atomic_load_explicit(&current, std::memory_order_acquire);
+    }
+
+    void store(T next) {
+        std::atomic_store_explicit(&current, snapshot(std::make_shared<const T>(std::move(next))), std::memory_order_release);
+    }
+
+    // copy, modify, swap; retried if another update got in between
+    template<typename F>
+    void update(F&& modify) {
+        auto expected = load();
+        for (;;) {
+            auto next = std::make_shared<T>(*expected);
+            modify(*next);
+            if (std::atomic_compare_exchange_weak_explicit(&current, &expected, snapshot(std::move(next)),
+                    std::memory_order_acq_rel, std::memory_order_acquire)) {
+                return;
+            }
+        }
+    }
+private:
+    snapshot current;
+}; // class shared_config
+
+} // namespace util
+} // namespace afsm
@@ -22,5 +22,19 @@ std::string type_name() {
     return demangle(typeid(T).name()); 
 }
 
+// defers demangling until the name is actually printed
+struct lazy_type_name {
+    const std::type_info* ti;
+
+    std::string str() const {
+        return demangle(ti->name());
+    }
+};
+
+template<class T>
+lazy_type_name lazy_type_name_of() {
+    return lazy_type_name{&typeid(T)};
+}
+
 } // namespace util
 } // namespace afsm
@@ -0,0 +1,60 @@
+// afsm::util::decorrelated_jitter: delays stay between the base and the cap,
+// grow by at most three times, and a cap near duration::max() is still the
+// upper bound.
+
+// ours
+#include <check.hpp>
+
+#include <afsm/util/backoff.hpp>
+
+// std
+#include <chrono>
+
+using ms = afsm::util::decorrelated_jitter::duration;
+
+// base <= d <= min(cap, 3 * previous), also after reset()
+static void stays_within_bounds() {
+    afsm::util::decorrelated_jitter jitter(ms(10), ms(1000));
+    auto prev = ms(10);
+    bool capped = false;
+    for (int i = 0; i < 10000; ++i) {
+        if (i == 5000) {
+            jitter.reset();
+            prev = ms(10);
+        }
+        auto d = jitter.next();
+        CHECK(d >= ms(10) && d <= ms(1000) && d <= prev * 3);
+        capped = capped || d > ms(900);
+        prev = d;
+    }
+    CHECK(capped);
+}
+
+// three times the previous delay overflows, the cap bounds the draw instead
+// of the base
+static void caps_when_tripled_delay_overflows() {
+    auto cap = ms::max();
+    auto base = cap / 2;
+    afsm::util::decorrelated_jitter jitter(base, cap);
+    bool above_base = false;
+    for (int i = 0; i < 100; ++i) {
+        auto d = jitter.next();
+        CHECK(d >= base && d <= cap);
+        above_base = above_base || d > base;
+    }
+    CHECK(above_base);
+}
+
+// a base above the cap is used as is
+static void keeps_base_above_cap() {
+    afsm::util::decorrelated_jitter jitter(ms(50), ms(10));
+    for (int i = 0; i < 100; ++i) {
+        CHECK(jitter.next() == ms(50));
+    }
+}
+
+int main() {
+    stays_within_bounds();
+    caps_when_tripled_delay_overflows();
+    keeps_base_above_cap();
+}
@@ -0,0 +1,204 @@
+// afsm::checkpoint_file: a record torn by a crash is written again, lengths
+// read from a record are checked, a record the state can not be rebuilt from
+// starts the machine over.
+
+// ours
+#include <check.hpp>
+
+#include <afsm/checkpoint.hpp>
+#include <afsm/state.hpp>
+#include <afsm/state_machine.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+
+// system
+#include <fcntl.h>
+#include <unistd.h>
+
+struct go {};
+struct tock {};
+
+struct context {
+    context(asio::io_service& io) : io(io), started_over(false) {}
+    asio::io_service&   io;
+    bool                started_over;
+};
+
+// the start state
+class fresh : public afsm::state<go> {
+public:
+    fresh(asio::io_service& io) : state(io) {}
+
+    virtual void on_enter() override {
+        complete<go>();
+    }
+
+    virtual void cancel() override {}
+};
+
+// recorded with the address it talks to
+class talking : public afsm::state<tock> {
+public:
+    talking(asio::io_service& io, std::string address) : state(io), address(std::move(address)) {}
+
+    virtual void on_enter() override {
+        complete<tock>();
+    }
+
+    virtual void cancel() override {}
+
+    std::string address;
+};
+
+struct done {
+    template<typename Event>
+    done(asio::io_service&, const Event&) {}
+};
+
+namespace afsm {
+
+template<>
+struct state_factory<fresh, std::monostate, ::context> {
+    auto operator()(const std::monostate&, ::context& ctx) const {
+        ctx.started_over = true;
+        return std::make_tuple(std::ref(ctx.io));
+    }
+};
+
+template<>
+struct state_factory<talking, go, ::context> {
+    auto operator()(const go&, ::context& ctx) const {
+        return std::make_tuple(std::ref(ctx.io), std::string("127.0.0.1"));
+    }
+};
+
+template<>
+struct state_checkpoint<talking, ::context> {
+    void save(const talking& s, const ::context&, checkpoint_writer& w) const {
+        w.write_string(s.address);
+    }
+
+    auto restore(checkpoint_reader& r, ::context& ctx) const {
+        return std::make_tuple(std::ref(ctx.io), asio::ip::make_address(r.read_string()).to_string());
+    }
+};
+
+template<>
+struct result_factory<tock, ::context> {
+    bool operator()(const tock&, ::context& ctx) const {
+        return ctx.started_over;
+    }
+};
+
+} // namespace afsm
+
+struct traits {
+    using start_state = fresh;
+    using end_state = done;
+    using context = ::context;
+    using result = bool;
+    using transitions = afsm::transitions<
+        afsm::transition<fresh, go, talking>,
+        afsm::transition<talking, tock, done>
+    >;
+};
+
+using machine = afsm::state_machine<traits>;
+
+static std::string temp_path() {
+    return "/tmp/afsm-checkpoint-test-" + std::to_string(::getpid());
+}
+
+// runs a machine on record 0 of `file`, true when it started over
+static bool run(afsm::checkpoint_file& file) {
+    asio::io_service io;
+    machine m(io);
+    m.checkpoint(file, 0);
+    std::optional<bool> res;
+    m.async_wait([&](bool r) { res = r; });
+    io.run();
+    CHECK(res);
+    return *res;
+}
+
+// records `address` as the state to resume in
+static void save_talking(afsm::checkpoint_file& file, const std::string& address) {
+    asio::io_service io;
+    context ctx(io);
+    afsm::checkpoint_slot(file, 0).save<machine>(talking(io, address), ctx);
+}
+
+static void resumes_recorded_state() {
+    auto path = temp_path();
+    {
+        afsm::checkpoint_file file(path, 1);
+        save_talking(file, "127.0.0.1");
+        CHECK(file.resumable() == 1);
+        CHECK(!run(file));
+    }
+    ::unlink(path.c_str());
+}
+
+// a process that died writing the record left its seq odd
+static void rewrites_torn_record() {
+    auto path = temp_path();
+    {
+        afsm::checkpoint_file file(path, 1);
+    }
+    int fd = ::open(path.c_str(), O_RDWR);
+    CHECK(fd >= 0);
+    std::uint32_t torn = 3;
+    CHECK(::pwrite(fd, &torn, sizeof(torn), sizeof(afsm::detail::checkpoint_header)) == sizeof(torn));
+    ::close(fd);
+    {
+        afsm::checkpoint_file file(path, 1);
+        CHECK(file.resumable() == 0);
+        save_talking(file, "127.0.0.1");
+        CHECK(file.resumable() == 1);
+    }
+    ::unlink(path.c_str());
+}
+
+// a string longer than the record is not allocated
+static void checks_string_length() {
+    char record[8];
+    std::uint32_t n = 0xfffffff0;
+    std::memcpy(record, &n, sizeof(n));
+    afsm::checkpoint_reader r(record, sizeof(record));
+    bool truncated = false;
+    try {
+        r.read_string();
+    } catch (const std::out_of_range&) {
+        truncated = true;
+    }
+    CHECK(truncated);
+}
+
+// restore() throwing anything (make_address here) starts the machine over
+static void starts_over_when_restore_fails() {
+    auto path = temp_path();
+    {
+        afsm::checkpoint_file file(path, 1);
+        save_talking(file, "not an address");
+        CHECK(file.resumable() == 1);
+        CHECK(run(file));
+    }
+    ::unlink(path.c_str());
+}
+
+int main() {
+    resumes_recorded_state();
+    rewrites_torn_record();
+    checks_string_length();
+    starts_over_when_restore_fails();
+}
@@ -0,0 +1,212 @@
+// async_wait() of states and machines with completion tokens other than a
+// plain callback: asio::use_future, handlers bound to a strand, handlers
+// with an allocator of their own and move-only handlers.
+
+// ours
+#include <check.hpp>
+
+#include <afsm/state.hpp>
+#include <afsm/state_machine.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <array>
+#include <cstddef>
+#include <future>
+#include <memory>
+#include <thread>
+#include <variant>
+#include <vector>
+
+struct finished {
+    int value;
+};
+
+// completes right away, from a handler of its own
+class quick : public afsm::state<finished> {
+public:
+    quick(asio::io_service& io) : state(io) {}
+
+    // built by the default state_factory
+    quick(asio::io_service& io, const std::monostate&) : state(io) {}
+
+    virtual void on_enter() override {
+        post(track([this] { complete<finished>(finished{42}); }));
+    }
+
+    virtual void cancel() override {}
+};
+
+struct done {
+    template<typename Event>
+    done(asio::io_service&, const Event&) {}
+};
+
+struct context {
+    context(asio::io_service& io) : io(io) {}
+    asio::io_service& io;
+};
+
+namespace afsm {
+
+template<>
+struct result_factory<finished, ::context> {
+    int operator()(const finished& ev, ::context&) const {
+        return ev.value;
+    }
+};
+
+} // namespace afsm
+
+struct traits {
+    using start_state = quick;
+    using end_state = done;
+    using context = ::context;
+    using result = int;
+    using transitions = afsm::transitions<
+        afsm::transition<quick, finished, done>
+    >;
+};
+
+using machine = afsm::state_machine<traits>;
+
+// counts what goes through it, for handlers that carry their own allocator
+struct counting_stats {
+    std::size_t allocated = 0;
+    std::size_t released = 0;
+};
+
+template<typename T>
+struct counting_allocator {
+    using value_type = T;
+
+    counting_allocator(counting_stats& stats) noexcept : stats(&stats) {}
+
+    template<typename U>
+    counting_allocator(const counting_allocator<U>& other) noexcept : stats(other.stats) {}
+
+    T* allocate(std::size_t n) {
+        ++stats->allocated;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        ++stats->released;
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template<typename U>
+    bool operator==(const counting_allocator<U>& other) const noexcept {
+        return stats == other.stats;
+    }
+
+    template<typename U>
+    bool operator!=(const counting_allocator<U>& other) const noexcept {
+        return stats != other.stats;
+    }
+
+    counting_stats* stats;
+};
+
+// too large to be kept in place, so it goes through its allocator
+struct large_handler {
+    using allocator_type = counting_allocator<void>;
+
+    allocator_type get_allocator() const noexcept {
+        return allocator_type(*stats);
+    }
+
+    void operator()(int r) {
+        // released before the handler runs
+        CHECK(stats->allocated == 1 && stats->released == 1);
+        *result = r;
+    }
+
+    counting_stats*             stats;
+    int*                        result;
+    std::array<char, 256>       padding;
+};
+
+// the machine's result comes out of a future, the io_service runs elsewhere
+static void completes_future() {
+    asio::io_service io;
+    auto work = asio::make_work_guard(io);
+    std::thread t([&] { io.run(); });
+
+    machine m(io);
+    std::future<int> f = asio::post(io, asio::use_future([&] { return m.async_wait(asio::use_future); })).get();
+    CHECK(f.get() == 42);
+
+    quick q(io);
+    auto fs = asio::post(io, asio::use_future([&] { return q.async_wait(asio::use_future); })).get();
+    CHECK(std::get<finished>(fs.get()).value == 42);
+
+    work.reset();
+    t.join();
+}
+
+// handlers bound to a strand run on it, those of many machines completing on
+// several threads one at a time
+static void runs_on_bound_strand() {
+    asio::io_service io;
+    asio::io_service::strand strand(io);
+    std::vector<std::unique_ptr<machine>> machines;
+    int completed = 0;     // only touched on the strand
+    for (int i = 0; i < 200; ++i) {
+        machines.push_back(std::make_unique<machine>(io));
+        machines.back()->async_wait(asio::bind_executor(strand, [&](int r) {
+            CHECK(strand.running_in_this_thread());
+            CHECK(r == 42);
+            ++completed;
+        }));
+    }
+
+    quick q(io);
+    bool state_done = false;
+    q.async_wait(asio::bind_executor(strand, [&](const quick::result& r) {
+        CHECK(strand.running_in_this_thread());
+        CHECK(std::get<finished>(r).value == 42);
+        state_done = true;
+    }));
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&] { io.run(); });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    CHECK(completed == 200);
+    CHECK(state_done);
+}
+
+// a handler too large to be kept in place comes from its own allocator
+static void uses_handler_allocator() {
+    asio::io_service io;
+    counting_stats stats;
+    int result = 0;
+    machine m(io);
+    m.async_wait(large_handler{&stats, &result, {}});
+    io.run();
+    CHECK(result == 42);
+    CHECK(stats.allocated == 1 && stats.released == 1);
+}
+
+// a handler that can only be moved
+static void takes_move_only_handler() {
+    asio::io_service io;
+    int result = 0;
+    machine m(io);
+    m.async_wait([&result, owned = std::make_unique<int>(1)](int r) { result = r + *owned; });
+    io.run();
+    CHECK(result == 43);
+}
+
+int main() {
+    completes_future();
+    runs_on_bound_strand();
+    uses_handler_allocator();
+    takes_move_only_handler();
+}
@@ -0,0 +1,252 @@
+// afsm::io::connection_pool against a loopback acceptor: a connection lent
+// out and taken back, a dropped connection redialed after the server was
+// gone for a while, a leasing state served when a connection parks, and
+// pools with parked, lent and dialing connections torn down with their
+// io_service.
+
+// ours
+#include <check.hpp>
+
+#include <afsm/io/connection_pool.hpp>
+#include <afsm/state_factory.hpp>
+#include <afsm/state_machine.hpp>
+#include <afsm/result_factory.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+// accepts every connection into `peers`
+struct server {
+    server(asio::io_service& io, unsigned short port = 0) :
+        io(io),
+        acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), port))
+    {
+        acceptor.listen();
+        accept();
+    }
+
+    void accept() {
+        peers.push_back(std::make_unique<asio::ip::tcp::socket>(io));
+        acceptor.async_accept(*peers.back(), [this](const std::error_code& ec) {
+            if (!ec) {
+                accept();
+            }
+        });
+    }
+
+    // connections accepted so far
+    std::size_t accepted() const {
+        return peers.size() - 1;
+    }
+
+    asio::ip::tcp::endpoint endpoint() const {
+        return acceptor.local_endpoint();
+    }
+
+    asio::io_service&                                       io;
+    asio::ip::tcp::acceptor                                 acceptor;
+    std::vector<std::unique_ptr<asio::ip::tcp::socket>>     peers;
+};
+
+// runs `io` for `d`, also after it ran out of work before
+static void run_for(asio::io_service& io, std::chrono::milliseconds d) {
+    io.restart();
+    io.run_for(d);
+}
+
+// runs `io` until `done` holds, at most for `limit`
+template<typename Pred>
+static bool run_until(asio::io_service& io, Pred done, std::chrono::milliseconds limit = std::chrono::seconds(5)) {
+    auto deadline = std::chrono::steady_clock::now() + limit;
+    while (!done() && std::chrono::steady_clock::now() < deadline) {
+        run_for(io, std::chrono::milliseconds(5));
+    }
+    return done();
+}
+
+// a recycled connection is parked and lent out again, no new one is dialed
+static void lends_and_takes_back() {
+    asio::io_service io;
+    server srv(io);
+    afsm::io::pool_options opts;
+    opts.connections = 1;
+    afsm::io::connection_pool pool(io, srv.endpoint(), opts);
+
+    int leased = 0;
+    for (int i = 0; i < 3; ++i) {
+        pool.async_lease([&](const std::error_code& ec, afsm::io::lease l) {
+            CHECK(!ec && l);
+            ++leased;
+            l.recycle();
+        });
+    }
+    CHECK(run_until(io, [&] { return leased == 3 && pool.available() == 1; }));
+    CHECK(srv.accepted() == 1);
+    pool.stop();
+    run_for(io, std::chrono::milliseconds(10));
+}
+
+// the lessee finds the connection dropped by the server, which is gone: the
+// member waits in redial_wait between failed dials until the server is back
+static void redials_dropped_connection() {
+    asio::io_service io;
+    std::optional<server> srv(std::in_place, io);
+    auto ep = srv->endpoint();
+    afsm::io::pool_options opts;
+    opts.connections = 1;
+    afsm::io::connection_pool pool(io, ep, opts);
+
+    std::optional<afsm::io::lease> held;
+    pool.async_lease([&](const std::error_code& ec, afsm::io::lease l) {
+        CHECK(!ec);
+        held = std::move(l);
+    });
+    CHECK(run_until(io, [&] { return held && srv->accepted() == 1; }));
+    srv.reset();
+
+    char byte;
+    std::optional<std::error_code> dropped;
+    held->socket().async_read_some(asio::buffer(&byte, 1), [&](const std::error_code& ec, std::size_t) { dropped = ec; });
+    CHECK(run_until(io, [&] { return dropped.has_value(); }));
+    CHECK(*dropped == asio::error::eof);
+    held->discard();
+    // dials fail while nobody listens
+    run_for(io, std::chrono::milliseconds(50));
+
+    auto back = std::chrono::steady_clock::now();
+    srv.emplace(io, ep.port());
+    bool leased = false;
+    pool.async_lease([&](const std::error_code& ec, afsm::io::lease l) {
+        CHECK(!ec && l);
+        leased = true;
+        l.recycle();
+    });
+    CHECK(run_until(io, [&] { return leased; }));
+    CHECK(srv->accepted() == 1);
+    // the redial waited for its backoff, not for the server
+    CHECK(std::chrono::steady_clock::now() - back < std::chrono::seconds(2));
+    pool.stop();
+    run_for(io, std::chrono::milliseconds(10));
+}
+
+// a machine leasing from the pool
+struct lease_context {
+    lease_context(asio::io_service& io, afsm::io::connection_pool& pool) : io(io), pool(pool) {}
+    asio::io_service&               io;
+    afsm::io::connection_pool&      pool;
+};
+
+struct lease_done {
+    template<typename Event>
+    lease_done(asio::io_service&, const Event&) {}
+};
+
+namespace afsm {
+
+template<>
+struct state_factory<io::leasing, std::monostate, ::lease_context> {
+    auto operator()(const std::monostate&, ::lease_context& ctx) const {
+        return std::make_tuple(std::ref(ctx.io), std::ref(ctx.pool));
+    }
+};
+
+// true when a connection was leased, which goes back to the pool
+template<typename Event>
+struct result_factory<Event, ::lease_context> {
+    bool operator()(const Event& ev, ::lease_context&) const {
+        if constexpr (std::is_same_v<Event, io::leased>) {
+            static_cast<io::lease&>(ev).recycle();
+            return true;
+        } else {
+            return false;
+        }
+    }
+};
+
+} // namespace afsm
+
+struct lease_traits {
+    using start_state = afsm::io::leasing;
+    using end_state = lease_done;
+    using context = lease_context;
+    using result = bool;
+    using transitions = afsm::transitions<
+        afsm::transition<afsm::io::leasing, afsm::io::leased, lease_done>,
+        afsm::transition<afsm::io::leasing, afsm::io::lease_failed, lease_done>,
+        afsm::transition<afsm::io::leasing, afsm::io::lease_stopped, lease_done>
+    >;
+};
+
+// the only connection is lent out, the leasing state gets it once it parks
+static void serves_leasing_waiter() {
+    asio::io_service io;
+    server srv(io);
+    afsm::io::pool_options opts;
+    opts.connections = 1;
+    afsm::io::connection_pool pool(io, srv.endpoint(), opts);
+
+    std::optional<afsm::io::lease> held;
+    pool.async_lease([&](const std::error_code& ec, afsm::io::lease l) {
+        CHECK(!ec);
+        held = std::move(l);
+    });
+    CHECK(run_until(io, [&] { return held.has_value(); }));
+
+    afsm::state_machine<lease_traits> m(io);
+    std::optional<bool> res;
+    m.async_wait([&](bool leased) { res = leased; }, std::ref(pool));
+    run_for(io, std::chrono::milliseconds(20));
+    CHECK(!res);
+
+    held->recycle();
+    CHECK(run_until(io, [&] { return res.has_value(); }));
+    CHECK(*res);
+    CHECK(run_until(io, [&] { return pool.available() == 1; }));
+    CHECK(srv.accepted() == 1);
+    pool.stop();
+    run_for(io, std::chrono::milliseconds(10));
+}
+
+// pools are stopped and destroyed with the io_service, whatever their members do
+static void tears_down_with_io_service() {
+    int leased = 0;
+    {
+        asio::io_service io;
+        auto& pools = asio::use_service<afsm::io::connection_pools>(io);
+        server srv(io);
+
+        afsm::io::pool_options opts;
+        opts.connections = 2;
+        auto& pool = pools.get(srv.endpoint(), opts);
+        // one connection lent out and recycled, the other stays parked
+        pool.async_lease([&](const std::error_code& ec, afsm::io::lease l) {
+            CHECK(!ec);
+            ++leased;
+            l.recycle();
+        });
+        // a pool that never connects keeps dialing
+        asio::ip::tcp::acceptor closed(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+        pools.get(closed.local_endpoint());
+        io.run_for(std::chrono::milliseconds(100));
+    }
+    CHECK(leased == 1);
+}
+
+int main() {
+    lends_and_takes_back();
+    redials_dropped_connection();
+    serves_leasing_waiter();
+    tears_down_with_io_service();
+}
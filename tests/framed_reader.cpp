@@ -0,0 +1,170 @@
+// afsm::io::framed_reader against a loopback connection: frames split across
+// reads, several frames per read, a length prefix larger than the buffer and
+// incomplete frames moved to the front of a buffer the stream went through
+// many times over.
+
+// ours
+#include <check.hpp>
+
+#include <afsm/io/framed_reader.hpp>
+#include <afsm/io/framing.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+struct connection {
+    connection(asio::io_service& io) : local(io), peer(io) {
+        asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+        peer.connect(acceptor.local_endpoint());
+        acceptor.accept(local);
+    }
+
+    void write(std::string_view data) {
+        asio::write(peer, asio::buffer(data.data(), data.size()));
+    }
+
+    asio::ip::tcp::socket local;
+    asio::ip::tcp::socket peer;
+};
+
+// reads until an error, keeping every frame and the frames of each read
+template<typename Framing>
+struct collector {
+    collector(asio::ip::tcp::socket& sock, std::size_t capacity, Framing framing = Framing{}) :
+        reader(sock, capacity, std::move(framing))
+    {}
+
+    void start() {
+        // a move-only handler, re-armed from inside the previous one
+        reader.async_read_frames([this, token = std::make_unique<int>(0)](const std::error_code& ec, auto& batch) {
+            std::size_t n = 0;
+            for (std::string_view f : batch) {
+                frames.emplace_back(f);
+                ++n;
+            }
+            per_read.push_back(n);
+            if (ec) {
+                error = ec;
+                return;
+            }
+            start();
+        });
+    }
+
+    afsm::io::framed_reader<Framing>    reader;
+    std::vector<std::string>            frames;
+    std::vector<std::size_t>            per_read;
+    std::error_code                     error;
+};
+
+static std::string with_length(std::uint32_t len, std::string_view payload) {
+    std::string s;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        s += static_cast<char>((len >> shift) & 0xff);
+    }
+    s += payload;
+    return s;
+}
+
+// the first read ends inside a frame, the frame is complete after the next
+static void joins_frame_split_across_reads() {
+    asio::io_service io;
+    connection c(io);
+    collector<afsm::io::delimited> col(c.local, 1024);
+    col.start();
+
+    c.write("hel");
+    while (col.per_read.empty()) {
+        io.run_one();
+    }
+    CHECK(col.frames.empty());
+    CHECK(col.reader.pending() == "hel");
+
+    c.write("lo\n");
+    while (col.frames.empty()) {
+        io.run_one();
+    }
+    CHECK(col.frames == std::vector<std::string>{"hello"});
+    CHECK(col.reader.pending().empty());
+}
+
+// every complete frame of a read comes in one batch
+static void batches_frames_of_one_read() {
+    asio::io_service io;
+    connection c(io);
+    collector<afsm::io::delimited> col(c.local, 1024, afsm::io::delimited("\r\n"));
+    col.start();
+
+    c.write("a\r\nbb\r\nccc\r\nd");
+    while (col.frames.empty()) {
+        io.run_one();
+    }
+    CHECK(col.per_read.back() == 3);
+    CHECK(col.frames == std::vector<std::string>{"a", "bb", "ccc"});
+    CHECK(col.reader.pending() == "d");
+}
+
+// a frame that can not fit fails the read with message_size
+static void fails_frame_larger_than_buffer() {
+    asio::io_service io;
+    connection c(io);
+    collector<afsm::io::length_prefixed<>> col(c.local, 16);
+    col.start();
+
+    c.write(with_length(4, "ping") + with_length(100, std::string(20, 'x')));
+    while (!col.error) {
+        io.run_one();
+    }
+    CHECK(col.error == std::errc::message_size);
+    CHECK(col.frames == std::vector<std::string>{"ping"});
+}
+
+// far more bytes than the buffer holds: incomplete frames are moved to the
+// front over and over and every frame still comes out whole and in order
+static void compacts_incomplete_frames() {
+    asio::io_service io;
+    connection c(io);
+    collector<afsm::io::delimited> col(c.local, 16);
+    col.start();
+
+    std::vector<std::string> expected;
+    std::string data;
+    for (int i = 0; i < 200; ++i) {
+        expected.push_back("frame-" + std::to_string(i));
+        data += expected.back() + "\n";
+    }
+    c.write(data);
+    c.peer.shutdown(asio::ip::tcp::socket::shutdown_send);
+    io.run();
+    CHECK(col.error == asio::error::eof);
+    CHECK(col.frames == expected);
+    CHECK(col.per_read.size() > data.size() / 16);
+}
+
+// an empty delimiter would yield empty frames forever
+static void rejects_empty_delimiter() {
+    bool rejected = false;
+    try {
+        afsm::io::delimited d("");
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+}
+
+int main() {
+    joins_frame_split_across_reads();
+    batches_frames_of_one_read();
+    fails_frame_larger_than_buffer();
+    compacts_incomplete_frames();
+    rejects_empty_delimiter();
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+// std
+#include <cstdio>
+#include <cstdlib>
+
+// the tests run without a framework: a failed check reports itself and exits
+#define CHECK(...) \
+    do { \
+        if (!(__VA_ARGS__)) { \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #__VA_ARGS__); \
+            std::exit(1); \
+        } \
+    } while (0)
@@ -0,0 +1,321 @@
+// state_machine::migrate(): an idle machine, a state suspended and moved, a
+// state that can not be moved, a state whose event is already queued, and
+// cancel() landing before, during and after the hop between io_services,
+// also from a thread of its own.
+
+// ours
+#include <check.hpp>
+
+#include <afsm/state.hpp>
+#include <afsm/state_machine.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+struct tock {};
+struct stop {};
+
+struct context {
+    context(asio::io_service& io) : io(io), moved(0) {}
+
+    std::reference_wrapper<asio::io_service>    io;
+    std::vector<asio::io_service*>              entered;    // io_service each state was built on
+    int                                         moved;
+};
+
+// waits MS milliseconds (0: completes right away), can be moved
+template<int MS>
+class waiting : public afsm::state<tock, stop> {
+public:
+    waiting(asio::io_service& io, context& ctx) : state(io), ctx(ctx), timer(io, std::chrono::milliseconds(MS)) {}
+
+    waiting(asio::io_service& io, waiting&& from) : state(io), ctx(from.ctx), timer(io, from.timer.expiry()) {
+        ++ctx.moved;
+    }
+
+    virtual void on_enter() override {
+        if (MS == 0) {
+            return complete<tock>();
+        }
+
+        timer.async_wait(track([this](const std::error_code& ec) {
+            if (!ec) {
+                complete<tock>();
+            }
+        }));
+    }
+
+    virtual void on_suspend() override {
+        timer.cancel();
+    }
+
+    virtual void cancel() override {
+        complete<stop>();
+        timer.cancel();
+    }
+private:
+    context&            ctx;
+    asio::steady_timer  timer;
+};
+
+// waits MS milliseconds, can not be moved
+template<int MS>
+class busy : public afsm::state<tock, stop> {
+public:
+    busy(asio::io_service& io, context&) : state(io), timer(io, std::chrono::milliseconds(MS)) {}
+
+    virtual void on_enter() override {
+        timer.async_wait(track([this](const std::error_code& ec) {
+            if (!ec) {
+                complete<tock>();
+            }
+        }));
+    }
+
+    virtual void cancel() override {
+        complete<stop>();
+        timer.cancel();
+    }
+private:
+    asio::steady_timer timer;
+};
+
+// where the machine continues, completes from a handler of its own so that
+// a cancel applied on entry still wins
+class landed : public afsm::state<tock, stop> {
+public:
+    landed(asio::io_service& io, context&) : state(io) {}
+
+    virtual void on_enter() override {
+        post(track([this] { complete<tock>(); }));
+    }
+
+    virtual void cancel() override {
+        complete<stop>();
+    }
+};
+
+struct done {
+    template<typename Event>
+    done(asio::io_service&, const Event&) {}
+};
+
+// how the machine ended: on which io_service, after how many moves and
+// states built by state_factory
+struct outcome {
+    bool                cancelled;
+    asio::io_service*   io;
+    int                 moved;
+    std::size_t         built;
+};
+
+namespace afsm {
+
+template<typename State, typename Event>
+struct state_factory<State, Event, ::context> {
+    auto operator()(const Event&, ::context& ctx) const {
+        ctx.entered.push_back(&ctx.io.get());
+        return std::make_tuple(std::ref(ctx.io.get()), std::ref(ctx));
+    }
+};
+
+template<>
+struct result_factory<tock, ::context> {
+    outcome operator()(const tock&, ::context& ctx) const {
+        return {false, &ctx.io.get(), ctx.moved, ctx.entered.size()};
+    }
+};
+
+template<>
+struct result_factory<stop, ::context> {
+    outcome operator()(const stop&, ::context& ctx) const {
+        return {true, &ctx.io.get(), ctx.moved, ctx.entered.size()};
+    }
+};
+
+} // namespace afsm
+
+template<typename First>
+struct traits {
+    using start_state = First;
+    using end_state = done;
+    using context = ::context;
+    using result = outcome;
+    using transitions = afsm::transitions<
+        afsm::transition<First, tock, landed>,
+        afsm::transition<First, stop, done>,
+        afsm::transition<landed, tock, done>,
+        afsm::transition<landed, stop, done>
+    >;
+};
+
+template<typename First>
+using machine = afsm::state_machine<traits<First>>;
+
+// a machine not started yet moves right away
+static void moves_idle_machine() {
+    asio::io_service a;
+    asio::io_service b;
+    machine<waiting<1>> m(a);
+    bool arrived = false;
+    m.migrate(b, [&] { arrived = true; });
+    std::optional<outcome> res;
+    m.async_wait([&](const outcome& r) { res = r; });
+    CHECK(a.run() == 0);
+    b.run();
+    CHECK(arrived);
+    CHECK(res && !res->cancelled && res->io == &b && res->moved == 0 && res->built == 2);
+}
+
+// the waiting state is suspended, moved and carries on with its wait on `b`
+static void moves_suspended_state() {
+    asio::io_service a;
+    asio::io_service b;
+    machine<waiting<20>> m(a);
+    std::optional<outcome> res;
+    bool arrived = false;
+    m.async_wait([&](const outcome& r) { res = r; });
+    asio::post(a, [&] { m.migrate(b, [&] { arrived = true; }); });
+    a.run();
+    CHECK(!res && !arrived);
+    b.run();
+    CHECK(arrived);
+    CHECK(res && !res->cancelled && res->io == &b && res->moved == 1 && res->built == 2);
+}
+
+// a state that can not be moved completes on `a`, the next one starts on `b`
+static void waits_for_state_that_can_not_move() {
+    asio::io_service a;
+    asio::io_service b;
+    machine<busy<1>> m(a);
+    std::optional<outcome> res;
+    m.async_wait([&](const outcome& r) { res = r; });
+    asio::post(a, [&] { m.migrate(b); });
+    a.run();
+    b.run();
+    CHECK(res && !res->cancelled && res->io == &b && res->moved == 0 && res->built == 2);
+}
+
+// the state's event is queued already, it is not suspended a second time
+static void waits_for_queued_event() {
+    asio::io_service a;
+    asio::io_service b;
+    machine<waiting<0>> m(a);
+    std::optional<outcome> res;
+    m.async_wait([&](const outcome& r) { res = r; });
+    m.migrate(b);
+    a.run();
+    b.run();
+    CHECK(res && !res->cancelled && res->io == &b && res->moved == 0 && res->built == 2);
+}
+
+// cancel() reaches a state that is stopping its operations
+static void cancels_suspending_state() {
+    asio::io_service a;
+    asio::io_service b;
+    machine<waiting<3600 * 1000>> m(a);
+    std::optional<outcome> res;
+    bool arrived = false;
+    m.async_wait([&](const outcome& r) { res = r; });
+    asio::post(a, [&] {
+        m.migrate(b, [&] { arrived = true; });
+        m.cancel();
+    });
+    a.run();
+    b.run();
+    CHECK(arrived);
+    CHECK(res && res->cancelled && res->io == &b && res->moved == 0 && res->built == 1);
+}
+
+// cancel() reaches a state the migration waits for
+static void cancels_state_that_can_not_move() {
+    asio::io_service a;
+    asio::io_service b;
+    machine<busy<3600 * 1000>> m(a);
+    std::optional<outcome> res;
+    m.async_wait([&](const outcome& r) { res = r; });
+    asio::post(a, [&] {
+        m.migrate(b);
+        m.cancel();
+    });
+    a.run();
+    b.run();
+    CHECK(res && res->cancelled && res->io == &b && res->moved == 0 && res->built == 1);
+}
+
+// a cancel() landing while the moved state is on its way waits for it on `b`
+static void defers_cancel_across_hop() {
+    asio::io_service a;
+    asio::io_service b;
+    machine<waiting<3600 * 1000>> m(a);
+    std::optional<outcome> res;
+    m.async_wait([&](const outcome& r) { res = r; });
+    asio::post(a, [&] { m.migrate(b); });
+    a.run();
+    m.cancel();
+    b.run();
+    CHECK(res && res->cancelled && res->io == &b && res->moved == 1 && res->built == 1);
+}
+
+// as above with the event on its way, the state it leads to is cancelled
+static void defers_cancel_across_event_hop() {
+    asio::io_service a;
+    asio::io_service b;
+    machine<busy<1>> m(a);
+    std::optional<outcome> res;
+    m.async_wait([&](const outcome& r) { res = r; });
+    asio::post(a, [&] { m.migrate(b); });
+    a.run();
+    m.cancel();
+    b.run();
+    CHECK(res && res->cancelled && res->io == &b && res->moved == 0 && res->built == 2);
+}
+
+// post_cancel() from a third thread while `a` and `b` run on threads of their
+// own lands before, during or after the hop and is never lost
+static void cancels_from_another_thread_mid_hop() {
+    for (int i = 0; i < 200; ++i) {
+        asio::io_service a;
+        asio::io_service b;
+        auto work_a = asio::make_work_guard(a);
+        auto work_b = asio::make_work_guard(b);
+        std::thread ta([&] { a.run(); });
+        std::thread tb([&] { b.run(); });
+        machine<waiting<3600 * 1000>> m(a);
+        std::promise<outcome> res;
+        asio::post(a, [&] {
+            m.async_wait([&](const outcome& r) { res.set_value(r); });
+            m.migrate(b);
+        });
+        std::this_thread::sleep_for(std::chrono::microseconds(i % 50));
+        m.post_cancel();
+        auto r = res.get_future().get();
+        work_a.reset();
+        work_b.reset();
+        ta.join();
+        tb.join();
+        CHECK(r.cancelled && r.io == &b && r.built == 1);
+    }
+}
+
+int main() {
+    moves_idle_machine();
+    moves_suspended_state();
+    waits_for_state_that_can_not_move();
+    waits_for_queued_event();
+    cancels_suspending_state();
+    cancels_state_that_can_not_move();
+    defers_cancel_across_hop();
+    defers_cancel_across_event_hop();
+    cancels_from_another_thread_mid_hop();
+}
@@ -0,0 +1,74 @@
+// afsm::state_registry ownership of its shm name: a second registry on a
+// taken name fails with EEXIST, a registry removes its own table and never
+// one that took over the name after it was unlinked.
+
+// ours
+#include <check.hpp>
+
+#include <afsm/monitor.hpp>
+
+// std
+#include <string>
+#include <system_error>
+
+// system
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static std::string temp_name() {
+    return "/afsm-monitor-test-" + std::to_string(::getpid());
+}
+
+static bool exists(const std::string& name) {
+    int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    ::close(fd);
+    return true;
+}
+
+// the table of another registry is never replaced
+static void refuses_taken_name() {
+    auto name = temp_name();
+    afsm::state_registry first(name, 4);
+    std::error_code ec;
+    try {
+        afsm::state_registry second(name, 4);
+    } catch (const std::system_error& e) {
+        ec = e.code();
+    }
+    CHECK(ec == std::errc::file_exists);
+    CHECK(exists(name));
+}
+
+// the registry unlinks its own table when it goes away
+static void removes_own_table() {
+    auto name = temp_name();
+    {
+        afsm::state_registry r(name, 4);
+        CHECK(exists(name));
+    }
+    CHECK(!exists(name));
+}
+
+// the name was unlinked and taken by another object meanwhile, it stays
+static void keeps_replacing_table() {
+    auto name = temp_name();
+    {
+        afsm::state_registry r(name, 4);
+        ::shm_unlink(name.c_str());
+        int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        CHECK(fd >= 0);
+        ::close(fd);
+    }
+    CHECK(exists(name));
+    ::shm_unlink(name.c_str());
+}
+
+int main() {
+    refuses_taken_name();
+    removes_own_table();
+    keeps_replacing_table();
+}
@@ -0,0 +1,197 @@
+// A machine used as a state of another machine: its result becomes the
+// enclosing machine's event, cancelling the enclosing machine reaches the
+// state the inner machine is in.
+
+// ours
+#include <check.hpp>
+
+#include <afsm/state.hpp>
+#include <afsm/state_machine.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <tuple>
+#include <variant>
+
+struct tock {};
+struct stop {};
+
+class waiting : public afsm::state<tock, stop> {
+public:
+    waiting(asio::io_service& io, std::chrono::milliseconds delay, bool& cancelled) :
+        state(io),
+        timer(io, delay),
+        cancelled(cancelled)
+    {}
+
+    virtual void on_enter() override {
+        timer.async_wait(track([this](const std::error_code& ec) {
+            ec ? complete<stop>() : complete<tock>();
+        }));
+    }
+
+    virtual void cancel() override {
+        cancelled = true;
+        complete<stop>();
+        timer.cancel();
+    }
+private:
+    asio::steady_timer  timer;
+    bool&               cancelled;
+};
+
+struct done {
+    template<typename Event>
+    done(asio::io_service&, const Event&) {}
+};
+
+// the inner machine waits twice before it reports how often it waited
+struct inner_context {
+    template<typename Event>
+    inner_context(asio::io_service& io, const Event&, std::chrono::milliseconds delay, bool& cancelled) :
+        io(io),
+        delay(delay),
+        cancelled(cancelled),
+        waits(0)
+    {}
+
+    asio::io_service&           io;
+    std::chrono::milliseconds   delay;
+    bool&                       cancelled;
+    int                         waits;
+};
+
+struct waited {
+    int waits;
+};
+
+// the second wait, a state type of its own so the machine stops after it
+class counted : public waiting {
+public:
+    using waiting::waiting;
+};
+
+namespace afsm {
+
+template<typename Event>
+struct state_factory<waiting, Event, inner_context> {
+    auto operator()(const Event&, inner_context& ctx) const {
+        ++ctx.waits;
+        return std::make_tuple(std::ref(ctx.io), ctx.delay, std::ref(ctx.cancelled));
+    }
+};
+
+template<typename Event>
+struct state_factory<counted, Event, inner_context> : state_factory<waiting, Event, inner_context> {};
+
+template<>
+struct result_factory<tock, inner_context> {
+    std::variant<waited, stop> operator()(const tock&, inner_context& ctx) const {
+        return waited{ctx.waits};
+    }
+};
+
+template<>
+struct result_factory<stop, inner_context> {
+    std::variant<waited, stop> operator()(const stop&, inner_context&) const {
+        return stop{};
+    }
+};
+
+} // namespace afsm
+
+struct inner_traits {
+    using start_state = waiting;
+    using end_state = done;
+    using context = inner_context;
+    using result = std::variant<waited, stop>;
+    using transitions = afsm::transitions<
+        afsm::transition<waiting, tock, counted>,
+        afsm::transition<waiting, stop, done>,
+        afsm::transition<counted, tock, done>,
+        afsm::transition<counted, stop, done>
+    >;
+};
+
+using inner = afsm::state_machine<inner_traits>;
+
+struct outer_context {
+    outer_context(asio::io_service& io, std::chrono::milliseconds delay) :
+        io(io),
+        delay(delay),
+        cancelled(false)
+    {}
+
+    asio::io_service&           io;
+    std::chrono::milliseconds   delay;
+    bool                        cancelled;
+};
+
+namespace afsm {
+
+template<>
+struct state_factory<inner, std::monostate, outer_context> {
+    auto operator()(const std::monostate& ev, outer_context& ctx) const {
+        return std::make_tuple(std::ref(ctx.io), ev, ctx.delay, std::ref(ctx.cancelled));
+    }
+};
+
+template<>
+struct result_factory<waited, outer_context> {
+    int operator()(const waited& ev, outer_context&) const {
+        return ev.waits;
+    }
+};
+
+template<>
+struct result_factory<stop, outer_context> {
+    int operator()(const stop&, outer_context& ctx) const {
+        return ctx.cancelled ? -1 : 0;
+    }
+};
+
+} // namespace afsm
+
+struct outer_traits {
+    using start_state = inner;
+    using end_state = done;
+    using context = outer_context;
+    using result = int;
+    using transitions = afsm::transitions<
+        afsm::transition<inner, waited, done>,
+        afsm::transition<inner, stop, done>
+    >;
+};
+
+using outer = afsm::state_machine<outer_traits>;
+
+// the inner machine's result completes the enclosing machine
+static void completes_with_inner_result() {
+    asio::io_service io;
+    outer m(io);
+    std::optional<int> res;
+    m.async_wait([&](int r) { res = r; }, std::chrono::milliseconds(1));
+    io.run();
+    CHECK(res == 2);
+}
+
+// the inner machine's active state is cancelled, its stop ends both machines
+static void cancel_reaches_inner_state() {
+    asio::io_service io;
+    outer m(io);
+    std::optional<int> res;
+    m.async_wait([&](int r) { res = r; }, std::chrono::hours(1));
+    asio::post(io, [&] { m.cancel(); });
+    io.run();
+    CHECK(res == -1);
+}
+
+int main() {
+    completes_with_inner_result();
+    cancel_reaches_inner_state();
+}
@@ -0,0 +1,221 @@
+// afsm::periodic, afsm::cadence and afsm::period_scheduler with short
+// periods: skip drops the deadlines missed while the machine was stalled,
+// catch_up replays them, machines of the same period share one grid, a
+// periodic state ends with Stopped when cancelled and the timer of a period
+// nobody waits for any more is stopped.
+
+// ours
+#include <check.hpp>
+
+#include <afsm/periodic.hpp>
+#include <afsm/state.hpp>
+#include <afsm/state_machine.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+struct due {
+    due(const afsm::elapsed& e) : e(e) {}
+    afsm::elapsed e;
+};
+struct stopped {};
+struct again {};
+struct enough {};
+
+// what one machine was asked to do and the ticks it saw
+struct run {
+    run(afsm::periodic_clock::duration period, afsm::overrun policy, std::size_t limit, afsm::periodic_clock::duration stall = 0ms) :
+        period(period),
+        policy(policy),
+        limit(limit),
+        stall(stall)
+    {}
+
+    afsm::periodic_clock::duration                  period;
+    afsm::overrun                                   policy;
+    std::size_t                                     limit;
+    afsm::periodic_clock::duration                  stall;      // blocks the io_service on the first tick
+    std::vector<afsm::elapsed>                      ticks;
+    std::vector<afsm::periodic_clock::time_point>   at;         // when each tick was seen
+};
+
+struct context {
+    context(asio::io_service& io, run& r) : io(io), r(r), beat(io, r.period, r.policy) {}
+    asio::io_service&   io;
+    run&                r;
+    afsm::cadence       beat;
+};
+
+using waiting = afsm::periodic<due, stopped>;
+
+// records the tick, waits for the next one until there are enough
+class counted : public afsm::state<again, enough> {
+public:
+    counted(asio::io_service& io, const due& ev, run& r) : state(io), ev(ev), r(r) {}
+
+    virtual void on_enter() override {
+        r.ticks.push_back(ev.e);
+        r.at.push_back(afsm::periodic_clock::now());
+        if (r.ticks.size() == 1) {
+            std::this_thread::sleep_for(r.stall);
+        }
+        r.ticks.size() < r.limit ? complete<again>() : complete<enough>();
+    }
+
+    virtual void cancel() override {}
+private:
+    due     ev;
+    run&    r;
+};
+
+struct done {
+    template<typename Event>
+    done(asio::io_service&, const Event&) {}
+};
+
+namespace afsm {
+
+template<typename Event>
+struct state_factory<waiting, Event, ::context> {
+    auto operator()(const Event&, ::context& ctx) const {
+        return std::make_tuple(std::ref(ctx.io), std::ref(ctx.beat));
+    }
+};
+
+template<>
+struct state_factory<counted, due, ::context> {
+    auto operator()(const due& ev, ::context& ctx) const {
+        return std::make_tuple(std::ref(ctx.io), ev, std::ref(ctx.r));
+    }
+};
+
+template<>
+struct result_factory<enough, ::context> {
+    bool operator()(const enough&, ::context&) const {
+        return false;
+    }
+};
+
+template<>
+struct result_factory<stopped, ::context> {
+    bool operator()(const stopped&, ::context&) const {
+        return true;
+    }
+};
+
+} // namespace afsm
+
+struct traits {
+    using start_state = waiting;
+    using end_state = done;
+    using context = ::context;
+    using result = bool;    // stopped
+    using transitions = afsm::transitions<
+        afsm::transition<waiting, due, counted>,
+        afsm::transition<waiting, stopped, done>,
+        afsm::transition<counted, again, waiting>,
+        afsm::transition<counted, enough, done>
+    >;
+};
+
+using machine = afsm::state_machine<traits>;
+
+static void run_to_end(run& r) {
+    asio::io_service io;
+    machine m(io);
+    std::optional<bool> res;
+    m.async_wait([&](bool stopped) { res = stopped; }, r);
+    io.run();
+    CHECK(res && !*res);
+    CHECK(r.ticks.size() == r.limit);
+}
+
+// the deadlines passed during the stall are reported as missed, not delivered
+static void skip_drops_missed_ticks() {
+    run r(20ms, afsm::overrun::skip, 3, 110ms);
+    run_to_end(r);
+    CHECK(r.ticks[0].missed == 0);
+    CHECK(r.ticks[1].deadline == r.ticks[0].deadline + r.period);
+    CHECK(r.ticks[1].missed >= 4);
+    CHECK(r.ticks[2].deadline == r.ticks[1].deadline + static_cast<int>(r.ticks[1].missed + 1) * r.period);
+    CHECK(r.ticks[2].deadline > r.ticks[0].deadline + r.stall);
+    CHECK(r.at[2] >= r.ticks[2].deadline);
+}
+
+// every deadline is delivered, the ones passed during the stall back to back
+static void catch_up_replays_missed_ticks() {
+    run r(20ms, afsm::overrun::catch_up, 7, 110ms);
+    run_to_end(r);
+    for (std::size_t i = 0; i < r.ticks.size(); ++i) {
+        CHECK(r.ticks[i].deadline == r.ticks[0].deadline + static_cast<int>(i) * r.period);
+        CHECK(r.ticks[i].missed == 0);
+        CHECK(r.at[i] >= r.ticks[i].deadline);
+    }
+    // deadlines 1 to 5 had passed when the stall ended
+    CHECK(r.at[5] - r.at[1] < r.period);
+}
+
+// a machine started later waits for the same deadlines, not a phase of its own
+static void shares_grid() {
+    asio::io_service io;
+    run r1(20ms, afsm::overrun::skip, 3);
+    run r2(20ms, afsm::overrun::skip, 3);
+    machine m1(io);
+    machine m2(io);
+    m1.async_wait([](bool) {}, r1);
+    io.run_for(7ms);
+    m2.async_wait([](bool) {}, r2);
+    io.run();
+    CHECK(r1.ticks.size() == 3 && r2.ticks.size() == 3);
+    CHECK((r2.ticks[0].deadline - r1.ticks[0].deadline) % r1.period == afsm::periodic_clock::duration::zero());
+    CHECK(r2.ticks[0].deadline <= r1.ticks[1].deadline);
+}
+
+// cancel() completes the waiting state with Stopped
+static void stops_when_cancelled() {
+    asio::io_service io;
+    run r(1h, afsm::overrun::skip, 1);
+    machine m(io);
+    std::optional<bool> res;
+    m.async_wait([&](bool stopped) { res = stopped; }, r);
+    asio::post(io, [&] { m.cancel(); });
+    io.run();
+    CHECK(res && *res);
+    CHECK(r.ticks.empty());
+}
+
+// a cadence waiting again right after the only other wait was cancelled
+// still gets its deadline
+static void waits_again_after_cancel() {
+    asio::io_service io;
+    afsm::cadence a(io, 20ms);
+    afsm::cadence b(io, 20ms);
+    std::optional<std::error_code> first;
+    std::optional<std::error_code> second;
+    a.async_wait([&](const std::error_code& ec, const afsm::elapsed&) { first = ec; });
+    a.cancel();
+    b.async_wait([&](const std::error_code& ec, const afsm::elapsed&) { second = ec; });
+    io.run();
+    CHECK(first && *first == asio::error::operation_aborted);
+    CHECK(second && !*second);
+}
+
+int main() {
+    skip_drops_missed_ticks();
+    catch_up_replays_missed_ticks();
+    shares_grid();
+    stops_when_cancelled();
+    waits_again_after_cancel();
+}
@@ -0,0 +1,151 @@
+// afsm::priority_scheduler: prioritized handlers and machines overtake the
+// io_service's FIFO under priority_scheduler::run() and keep plain FIFO order
+// under io_service::run().
+
+// ours
+#include <check.hpp>
+
+#include <afsm/priority_scheduler.hpp>
+#include <afsm/state.hpp>
+#include <afsm/state_machine.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <functional>
+#include <string>
+#include <tuple>
+
+struct next {};
+struct last {};
+
+// completes right away, the machine walks through three of them
+class step : public afsm::state<next, last> {
+public:
+    step(asio::io_service& io, int n) : state(io), n(n) {}
+
+    virtual void on_enter() override {
+        n < 3 ? complete<next>() : complete<last>();
+    }
+
+    virtual void cancel() override {}
+private:
+    int n;
+};
+
+struct finished {
+    template<typename Event>
+    finished(asio::io_service&, const Event&) {}
+};
+
+struct steps {
+    steps(asio::io_service& io) : io(io), n(0) {}
+    asio::io_service& io;
+    int n;
+};
+
+namespace afsm {
+
+template<typename Event>
+struct state_factory<step, Event, steps> {
+    auto operator()(const Event&, steps& ctx) const {
+        return std::make_tuple(std::ref(ctx.io), ++ctx.n);
+    }
+};
+
+template<>
+struct result_factory<last, steps> {
+    int operator()(const last&, steps& ctx) const {
+        return ctx.n;
+    }
+};
+
+} // namespace afsm
+
+struct urgent_traits {
+    using start_state = step;
+    using end_state = finished;
+    using context = steps;
+    using result = int;
+    static constexpr afsm::priority priority = afsm::priority::critical;
+    using transitions = afsm::transitions<
+        afsm::transition<step, next, step>,
+        afsm::transition<step, last, finished>
+    >;
+};
+
+using urgent = afsm::state_machine<urgent_traits>;
+
+// the machine is started behind a backlog of plain handlers, returns how
+// many of them ran before it completed
+template<typename Run>
+static int backlog_before_machine(Run&& run) {
+    asio::io_service io;
+    urgent m(io);
+    int fifo = 0;
+    int seen = -1;
+    asio::post(io, [&] {
+        for (int i = 0; i < 100; ++i) {
+            asio::post(io, [&] { ++fifo; });
+        }
+        m.async_wait([&](int n) {
+            CHECK(n == 3);
+            seen = fifo;
+        });
+    });
+    run(io);
+    CHECK(fifo == 100);
+    return seen;
+}
+
+static void machine_overtakes_fifo() {
+    CHECK(backlog_before_machine([](asio::io_service& io) { asio::use_service<afsm::priority_scheduler>(io).run(); }) == 0);
+    CHECK(backlog_before_machine([](asio::io_service& io) { io.run(); }) == 100);
+}
+
+// handlers posted through a priority_executor, the order they ran in
+template<typename Run>
+static std::string executor_order(Run&& run) {
+    asio::io_service io;
+    std::string order;
+    asio::post(io, [&] {
+        for (int i = 0; i < 3; ++i) {
+            asio::post(io, [&] { order += 'f'; });
+        }
+        asio::post(afsm::priority_executor(io, afsm::priority::low), [&] { order += 'l'; });
+        asio::post(afsm::priority_executor(io, afsm::priority::high), [&] { order += 'h'; });
+    });
+    run(io);
+    return order;
+}
+
+static void executor_overtakes_fifo() {
+    // high first, low alternates with the io_service's handlers
+    CHECK(executor_order([](asio::io_service& io) { asio::use_service<afsm::priority_scheduler>(io).run(); }) == "hflff");
+    CHECK(executor_order([](asio::io_service& io) { io.run(); }) == "ffflh");
+}
+
+// the next waiting level gets one handler in after `starvation_limit` in a row
+// from above it
+static void bounds_starvation() {
+    asio::io_service io;
+    auto& sched = asio::use_service<afsm::priority_scheduler>(io);
+    sched.set_starvation_limit(2);
+    std::string order;
+    asio::post(io, [&] {
+        sched.post(afsm::priority::high, [&] { order += 'h'; });
+        sched.post(afsm::priority::low, [&] { order += 'l'; });
+        for (int i = 0; i < 4; ++i) {
+            sched.post(afsm::priority::critical, [&] { order += 'c'; });
+        }
+    });
+    sched.run();
+    CHECK(order == "cchccl");
+}
+
+int main() {
+    machine_overtakes_fifo();
+    executor_overtakes_fifo();
+    bounds_starvation();
+}
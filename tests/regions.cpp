@@ -0,0 +1,233 @@
+// afsm::regions: regions on the enclosing machine's io_service and on another
+// thread, Join ending the state early, and cancellation reaching every region.
+
+// ours
+#include <check.hpp>
+
+#include <afsm/regions.hpp>
+#include <afsm/state.hpp>
+#include <afsm/state_machine.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <variant>
+
+struct tock {};
+struct fail {};
+struct stop {};
+
+// waits MS milliseconds, then succeeds or fails
+template<int MS, bool Succeeds>
+class waiting : public afsm::state<tock, fail, stop> {
+public:
+    // waits cut short, regions may run on other threads
+    static inline std::atomic<int> aborted{0};
+
+    waiting(asio::io_service& io) : state(io), timer(io, std::chrono::milliseconds(MS)) {}
+
+    virtual void on_enter() override {
+        timer.async_wait(track([this](const std::error_code& ec) {
+            if (ec) {
+                ++aborted;
+                return complete<stop>();
+            }
+            Succeeds ? complete<tock>() : complete<fail>();
+        }));
+    }
+
+    virtual void cancel() override {
+        complete<stop>();
+        timer.cancel();
+    }
+private:
+    asio::steady_timer timer;
+};
+
+struct done {
+    template<typename Event>
+    done(asio::io_service&, const Event&) {}
+};
+
+struct region_context {
+    region_context(asio::io_service& io) : io(io) {}
+    asio::io_service& io;
+};
+
+namespace afsm {
+
+template<int MS, bool Succeeds, typename Event>
+struct state_factory<waiting<MS, Succeeds>, Event, region_context> {
+    auto operator()(const Event&, region_context& ctx) const {
+        return std::make_tuple(std::ref(ctx.io));
+    }
+};
+
+// a region's result: 1 succeeded, 0 failed, -1 cancelled
+template<>
+struct result_factory<tock, region_context> {
+    int operator()(const tock&, region_context&) const { return 1; }
+};
+
+template<>
+struct result_factory<fail, region_context> {
+    int operator()(const fail&, region_context&) const { return 0; }
+};
+
+template<>
+struct result_factory<stop, region_context> {
+    int operator()(const stop&, region_context&) const { return -1; }
+};
+
+} // namespace afsm
+
+template<int MS, bool Succeeds = true>
+struct region_traits {
+    using start_state = waiting<MS, Succeeds>;
+    using end_state = done;
+    using context = region_context;
+    using result = int;
+    using transitions = afsm::transitions<
+        afsm::transition<start_state, tock, done>,
+        afsm::transition<start_state, fail, done>,
+        afsm::transition<start_state, stop, done>
+    >;
+};
+
+template<int MS, bool Succeeds = true>
+using region = afsm::state_machine<region_traits<MS, Succeeds>>;
+
+struct all_ok {};
+struct not_ok {};
+
+// done when both succeeded, or as soon as one did not
+struct join {
+    using result = std::variant<all_ok, not_ok>;
+
+    template<typename Results>
+    std::optional<result> operator()(const Results& results) const {
+        auto& a = std::get<0>(results);
+        auto& b = std::get<1>(results);
+        if ((a && *a != 1) || (b && *b != 1)) {
+            return not_ok{};
+        }
+        if (a && b) {
+            return all_ok{};
+        }
+        return std::nullopt;
+    }
+};
+
+// the second region runs on `remote` unless it is null
+struct enclosing_context {
+    enclosing_context(asio::io_service& io, asio::io_service* remote) : io(io), remote(remote) {}
+    asio::io_service&   io;
+    asio::io_service*   remote;
+};
+
+namespace afsm {
+
+template<typename First, typename Second, typename Event>
+struct state_factory<regions<join, First, Second>, Event, enclosing_context> {
+    auto operator()(const Event&, enclosing_context& ctx) const {
+        using placement = typename regions<join, First, Second>::placement;
+        return std::make_tuple(std::ref(ctx.io), placement{{&ctx.io, ctx.remote ? ctx.remote : &ctx.io}});
+    }
+};
+
+template<>
+struct result_factory<all_ok, enclosing_context> {
+    bool operator()(const all_ok&, enclosing_context&) const { return true; }
+};
+
+template<>
+struct result_factory<not_ok, enclosing_context> {
+    bool operator()(const not_ok&, enclosing_context&) const { return false; }
+};
+
+} // namespace afsm
+
+template<typename First, typename Second>
+struct enclosing_traits {
+    using both = afsm::regions<join, First, Second>;
+    using start_state = both;
+    using end_state = done;
+    using context = enclosing_context;
+    using result = bool;
+    using transitions = afsm::transitions<
+        afsm::transition<both, all_ok, done>,
+        afsm::transition<both, not_ok, done>
+    >;
+};
+
+// runs a machine with the two regions, `cancel_after` cancels it after that
+// long; its result tells whether both regions succeeded
+template<typename First, typename Second>
+static bool run(bool remote, std::optional<std::chrono::milliseconds> cancel_after = {}) {
+    asio::io_service io;
+    asio::io_service other;
+    auto work = asio::make_work_guard(other);
+    std::thread t([&] { other.run(); });
+
+    afsm::state_machine<enclosing_traits<First, Second>> m(io);
+    std::optional<bool> res;
+    m.async_wait([&](bool r) { res = r; }, remote ? &other : nullptr);
+    asio::steady_timer timer(io);
+    if (cancel_after) {
+        timer.expires_after(*cancel_after);
+        timer.async_wait([&](const std::error_code&) { m.cancel(); });
+    }
+    io.run();
+
+    work.reset();
+    t.join();
+    CHECK(res);
+    return *res;
+}
+
+using fast = region<1>;
+using slow = region<20>;
+using failing = region<1, false>;
+using endless = region<3600 * 1000>;
+using endless_state = waiting<3600 * 1000, true>;
+
+static void joins_local_regions() {
+    CHECK(run<fast, slow>(false));
+}
+
+static void joins_remote_region() {
+    CHECK(run<fast, slow>(true));
+}
+
+// Join ends the state early, the region still running is cancelled
+static void join_cancels_the_rest() {
+    CHECK(!run<failing, endless>(false));
+    CHECK(endless_state::aborted == 1);
+
+    CHECK(!run<failing, endless>(true));
+    CHECK(endless_state::aborted == 2);
+}
+
+// cancelling the enclosing machine reaches local and remote regions
+static void cancel_reaches_every_region() {
+    auto before = endless_state::aborted.load();
+    CHECK(!run<endless, endless>(false, std::chrono::milliseconds(10)));
+    CHECK(endless_state::aborted == before + 2);
+
+    CHECK(!run<endless, endless>(true, std::chrono::milliseconds(10)));
+    CHECK(endless_state::aborted == before + 4);
+}
+
+int main() {
+    joins_local_regions();
+    joins_remote_region();
+    join_cancels_the_rest();
+    cancel_reaches_every_region();
+}
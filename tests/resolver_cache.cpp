@@ -0,0 +1,165 @@
+// afsm::io::basic_resolver_cache with a local resolver stand-in: sharing,
+// expiry, least recently used eviction and a resolver completing inline.
+
+// ours
+#include <check.hpp>
+
+#include <afsm/io/resolver_cache.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// resolves "<n>" to 127.0.0.<n>, anything else fails
+class local_resolver {
+public:
+    using endpoint_type = asio::ip::tcp::endpoint;
+
+    struct entry {
+        endpoint_type endpoint() const {
+            return ep;
+        }
+
+        endpoint_type ep;
+    };
+
+    static inline int resolved = 0;
+    // invokes the handler from within async_resolve()
+    static inline bool completes_inline = false;
+
+    explicit local_resolver(asio::io_service& io) : io(io) {}
+
+    template<typename Handler>
+    void async_resolve(std::string host, std::string service, Handler&& handler) {
+        ++resolved;
+        std::vector<entry> results;
+        std::error_code ec = make_error_code(asio::error::host_not_found);
+        if (!host.empty() && host.find_first_not_of("0123456789") == std::string::npos) {
+            auto addr = asio::ip::address_v4((127u << 24) | static_cast<unsigned>(std::atoi(host.c_str())));
+            results.push_back({endpoint_type(addr, static_cast<unsigned short>(std::atoi(service.c_str())))});
+            ec = {};
+        }
+        if (completes_inline) {
+            return handler(ec, results);
+        }
+        asio::post(io, [handler = std::forward<Handler>(handler), ec, results]() mutable {
+            handler(ec, results);
+        });
+    }
+
+    void cancel() {}
+private:
+    asio::io_service& io;
+};
+
+using cache_type = afsm::io::basic_resolver_cache<local_resolver>;
+
+static void resolve(asio::io_service& io, cache_type& cache, const char* host) {
+    bool done = false;
+    cache.async_resolve(host, "80", [&](const std::error_code&, cache_type::endpoints_ptr) { done = true; });
+    io.restart();
+    io.run();
+    CHECK(done);
+}
+
+// concurrent waiters share one resolution, later callers get the cached result
+static void shares_resolutions() {
+    asio::io_service io;
+    auto& cache = asio::use_service<cache_type>(io);
+    local_resolver::resolved = 0;
+
+    int done = 0;
+    for (int i = 0; i < 3; ++i) {
+        cache.async_resolve("1", "80", [&](const std::error_code& ec, cache_type::endpoints_ptr eps) {
+            CHECK(!ec);
+            CHECK(eps->front() == asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), 80));
+            ++done;
+        });
+    }
+    io.run();
+    CHECK(done == 3);
+    CHECK(local_resolver::resolved == 1);
+    CHECK(cache.lookup("1", "80"));
+
+    resolve(io, cache, "1");
+    CHECK(local_resolver::resolved == 1);
+}
+
+// an expired entry is dropped when looked up
+static void expires() {
+    asio::io_service io;
+    auto& cache = asio::use_service<cache_type>(io);
+    cache.set_ttl(std::chrono::milliseconds(10), std::chrono::milliseconds(10));
+
+    resolve(io, cache, "1");
+    resolve(io, cache, "unknown");
+    CHECK(cache.size() == 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(!cache.lookup("1", "80"));
+    CHECK(!cache.lookup("unknown", "80"));
+    CHECK(cache.size() == 0);
+}
+
+// beyond the capacity the least recently used entry goes, never one in flight
+static void evicts_least_recently_used() {
+    asio::io_service io;
+    auto& cache = asio::use_service<cache_type>(io);
+    cache.set_capacity(2);
+    local_resolver::resolved = 0;
+
+    resolve(io, cache, "1");
+    resolve(io, cache, "2");
+    CHECK(cache.lookup("1", "80"));
+    resolve(io, cache, "3");
+    CHECK(cache.size() == 2);
+    CHECK(cache.lookup("1", "80"));
+    CHECK(!cache.lookup("2", "80"));
+    CHECK(cache.lookup("3", "80"));
+
+    int done = 0;
+    for (auto host : {"4", "5", "6"}) {
+        cache.async_resolve(host, "80", [&](const std::error_code& ec, cache_type::endpoints_ptr) {
+            CHECK(!ec);
+            ++done;
+        });
+    }
+    CHECK(cache.size() == 3);
+    io.restart();
+    io.run();
+    CHECK(done == 3);
+    CHECK(local_resolver::resolved == 6);
+
+    resolve(io, cache, "7");
+    CHECK(cache.size() == 2);
+    CHECK(cache.lookup("7", "80"));
+}
+
+// the resolution starts once the cache is unlocked, its handler may lock it
+static void resolves_inline() {
+    asio::io_service io;
+    auto& cache = asio::use_service<cache_type>(io);
+    local_resolver::resolved = 0;
+    local_resolver::completes_inline = true;
+
+    resolve(io, cache, "1");
+    resolve(io, cache, "unknown");
+    CHECK(cache.lookup("1", "80"));
+    CHECK(cache.size() == 2);
+    resolve(io, cache, "1");
+    CHECK(local_resolver::resolved == 2);
+    local_resolver::completes_inline = false;
+}
+
+int main() {
+    shares_resolutions();
+    expires();
+    evicts_least_recently_used();
+    resolves_inline();
+}
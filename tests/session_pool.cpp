@@ -0,0 +1,73 @@
+// afsm::io::session_pool reservations: released slots go to the waiters in
+// the order they asked for one, notify() leaves the other owners' waiters in
+// that order.
+
+// ours
+#include <check.hpp>
+
+#include <afsm/io/session_pool.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <optional>
+#include <vector>
+
+// reservations alone never start a session
+struct no_session {};
+
+using pool_type = afsm::io::session_pool<no_session>;
+
+// each waiter takes the slot it was woken for, and hands it on
+static void serves_waiters_in_order() {
+    asio::io_service io;
+    pool_type pool(1, {&io});
+    auto s = pool.reserve(io, [] {});
+    CHECK(s);
+
+    std::vector<int> woken;
+    for (int i = 0; i < 3; ++i) {
+        CHECK(!pool.reserve(io, [&, i] {
+            woken.push_back(i);
+            auto next = pool.reserve(io, [] { CHECK(false); });
+            CHECK(next);
+            pool.release(*next);
+        }));
+    }
+    pool.release(*s);
+    io.run();
+    CHECK(woken == std::vector<int>{0, 1, 2});
+}
+
+// the waiters of the notified owner go, the rest are still served in order
+static void notifies_owner_only() {
+    asio::io_service io;
+    pool_type pool(1, {&io});
+    auto s = pool.reserve(io, [] {});
+    CHECK(s);
+
+    int stopping = 0;
+    int other = 0;
+    std::vector<int> woken;
+    for (int i = 0; i < 4; ++i) {
+        CHECK(!pool.reserve(io, [&woken, i] { woken.push_back(i); }, i % 2 ? &other : &stopping));
+    }
+    pool.notify(&stopping);
+    io.run();
+    CHECK(woken == std::vector<int>{0, 2});
+
+    pool.release(*s);
+    io.restart();
+    io.run();
+    CHECK(woken == std::vector<int>{0, 2, 1});
+    pool.release(*pool.reserve(io, [] {}));
+    io.restart();
+    io.run();
+    CHECK(woken == std::vector<int>{0, 2, 1, 3});
+}
+
+int main() {
+    serves_waiters_in_order();
+    notifies_owner_only();
+}
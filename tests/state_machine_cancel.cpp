@@ -0,0 +1,209 @@
+// state_machine::cancel() landing while the active state's event is queued
+// cancels the state that event leads to; a state the cancel completes into
+// another one is the only state cancelled.
+
+// ours
+#include <check.hpp>
+
+#include <afsm/state.hpp>
+#include <afsm/state_machine.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <tuple>
+
+struct next {};
+struct stop {};
+
+// completes right away
+class first : public afsm::state<next, stop> {
+public:
+    first(asio::io_service& io) : state(io) {}
+
+    virtual void on_enter() override {
+        complete<next>();
+    }
+
+    virtual void cancel() override {
+        complete<stop>();
+    }
+};
+
+// waits until cancelled
+class second : public afsm::state<stop> {
+public:
+    second(asio::io_service& io) : state(io), timer(io, std::chrono::hours(1)) {}
+
+    virtual void on_enter() override {
+        timer.async_wait(track([this](const std::error_code&) {
+            complete<stop>();
+        }));
+    }
+
+    virtual void cancel() override {
+        complete<stop>();
+        timer.cancel();
+    }
+private:
+    asio::steady_timer timer;
+};
+
+struct done {
+    template<typename Event>
+    done(asio::io_service&, const Event&) {}
+};
+
+struct context {
+    context(asio::io_service& io) : io(io), entered_second(false) {}
+    asio::io_service&   io;
+    bool                entered_second;
+};
+
+namespace afsm {
+
+template<typename Event>
+struct state_factory<first, Event, context> {
+    auto operator()(const Event&, context& ctx) const {
+        return std::make_tuple(std::ref(ctx.io));
+    }
+};
+
+template<typename Event>
+struct state_factory<second, Event, context> {
+    auto operator()(const Event&, context& ctx) const {
+        ctx.entered_second = true;
+        return std::make_tuple(std::ref(ctx.io));
+    }
+};
+
+template<>
+struct result_factory<stop, context> {
+    bool operator()(const stop&, context& ctx) const {
+        return ctx.entered_second;
+    }
+};
+
+} // namespace afsm
+
+struct traits {
+    using start_state = first;
+    using end_state = done;
+    using context = ::context;
+    using result = bool;
+    using transitions = afsm::transitions<
+        afsm::transition<first, next, second>,
+        afsm::transition<first, stop, done>,
+        afsm::transition<second, stop, done>
+    >;
+};
+
+// first's event is queued, it ignores the cancel
+static void cancels_state_event_leads_to() {
+    asio::io_service io;
+    afsm::state_machine<traits> m(io);
+    std::optional<bool> res;
+    m.async_wait([&](bool entered_second) { res = entered_second; });
+    m.cancel();
+    io.run();
+    CHECK(res == true);
+}
+
+struct hangup {};
+struct closed {};
+struct aborted {};
+
+// waits until cancelled, then hangs up
+class talking : public afsm::state<hangup> {
+public:
+    talking(asio::io_service& io) : state(io), timer(io, std::chrono::hours(1)) {}
+
+    virtual void on_enter() override {
+        timer.async_wait(track([](const std::error_code&) {}));
+    }
+
+    virtual void cancel() override {
+        complete<hangup>();
+        timer.cancel();
+    }
+private:
+    asio::steady_timer timer;
+};
+
+// says goodbye from a handler of its own unless cancelled before
+class closing : public afsm::state<closed, aborted> {
+public:
+    closing(asio::io_service& io) : state(io) {}
+
+    virtual void on_enter() override {
+        post(track([this] { complete<closed>(); }));
+    }
+
+    virtual void cancel() override {
+        complete<aborted>();
+    }
+};
+
+struct call {
+    call(asio::io_service& io) : io(io) {}
+    asio::io_service& io;
+};
+
+namespace afsm {
+
+template<typename State, typename Event>
+struct state_factory<State, Event, call> {
+    auto operator()(const Event&, call& ctx) const {
+        return std::make_tuple(std::ref(ctx.io));
+    }
+};
+
+template<>
+struct result_factory<closed, call> {
+    std::string operator()(const closed&, call&) const {
+        return "closed";
+    }
+};
+
+template<>
+struct result_factory<aborted, call> {
+    std::string operator()(const aborted&, call&) const {
+        return "aborted";
+    }
+};
+
+} // namespace afsm
+
+struct call_traits {
+    using start_state = talking;
+    using end_state = done;
+    using context = call;
+    using result = std::string;
+    using transitions = afsm::transitions<
+        afsm::transition<talking, hangup, closing>,
+        afsm::transition<closing, closed, done>,
+        afsm::transition<closing, aborted, done>
+    >;
+};
+
+// the cancel completes talking into closing, which runs to completion
+static void cancel_leaves_next_state_alone() {
+    asio::io_service io;
+    afsm::state_machine<call_traits> m(io);
+    std::optional<std::string> res;
+    m.async_wait([&](const std::string& r) { res = r; });
+    asio::post(io, [&] { m.cancel(); });
+    io.run();
+    CHECK(res == "closed");
+}
+
+int main() {
+    cancels_state_event_leads_to();
+    cancel_leaves_next_state_alone();
+}
@@ -0,0 +1,104 @@
+// afsm::io::token_bucket: waiters admitted in the order they asked, tokens
+// refilled at the configured rate, a queued waiter cancelled without taking
+// a token.
+
+// ours
+#include <check.hpp>
+
+#include <afsm/io/token_bucket.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <chrono>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+using clock_type = std::chrono::steady_clock;
+
+// a burst of one: everybody after the first waits, and is served in turn
+static void admits_in_order() {
+    asio::io_service io;
+    auto& bucket = asio::use_service<afsm::io::token_bucket>(io);
+    bucket.configure(1000, 1);
+
+    std::vector<int> admitted;
+    for (int i = 0; i < 5; ++i) {
+        bucket.async_acquire([&, i](const std::error_code& ec) {
+            CHECK(!ec);
+            admitted.push_back(i);
+        });
+    }
+    CHECK(!bucket.try_acquire());
+    io.run();
+    CHECK(admitted == std::vector<int>{0, 1, 2, 3, 4});
+}
+
+// 100 tokens per second: five waiters behind an emptied bucket take 50ms
+static void refills_at_rate() {
+    asio::io_service io;
+    auto& bucket = asio::use_service<afsm::io::token_bucket>(io);
+    bucket.configure(100, 1);
+    CHECK(bucket.try_acquire());
+    CHECK(!bucket.try_acquire());
+
+    auto start = clock_type::now();
+    std::vector<clock_type::duration> at;
+    for (int i = 0; i < 5; ++i) {
+        bucket.async_acquire([&](const std::error_code& ec) {
+            CHECK(!ec);
+            at.push_back(clock_type::now() - start);
+        });
+    }
+    io.run();
+    CHECK(at.size() == 5);
+    CHECK(at.front() >= std::chrono::milliseconds(9));
+    CHECK(at.back() >= std::chrono::milliseconds(49));
+    CHECK(at.back() < std::chrono::milliseconds(500));
+}
+
+// the cancelled waiter completes with operation_aborted, the one behind it
+// gets the next token
+static void cancels_queued_waiter() {
+    asio::io_service io;
+    auto& bucket = asio::use_service<afsm::io::token_bucket>(io);
+    bucket.configure(50, 1);
+
+    std::vector<std::pair<int, std::error_code>> done;
+    std::vector<afsm::io::token_bucket::ticket> tickets;
+    for (int i = 0; i < 3; ++i) {
+        tickets.push_back(bucket.async_acquire([&, i](const std::error_code& ec) { done.emplace_back(i, ec); }));
+    }
+    bucket.cancel(tickets[1]);
+    bucket.cancel(tickets[0]);
+    auto start = clock_type::now();
+    io.run();
+    auto took = clock_type::now() - start;
+    CHECK(done.size() == 3);
+    CHECK(done[0].first == 0 && !done[0].second);
+    CHECK(done[1].first == 1 && done[1].second == asio::error::operation_aborted);
+    CHECK(done[2].first == 2 && !done[2].second);
+    CHECK(took >= std::chrono::milliseconds(19) && took < std::chrono::milliseconds(500));
+}
+
+// an unconfigured bucket admits everything right away
+static void admits_everything_unconfigured() {
+    asio::io_service io;
+    auto& bucket = asio::use_service<afsm::io::token_bucket>(io);
+    int admitted = 0;
+    for (int i = 0; i < 100; ++i) {
+        CHECK(bucket.try_acquire());
+        bucket.async_acquire([&](const std::error_code& ec) { admitted += !ec; });
+    }
+    io.run();
+    CHECK(admitted == 100);
+}
+
+int main() {
+    admits_in_order();
+    refills_at_rate();
+    cancels_queued_waiter();
+    admits_everything_unconfigured();
+}
@@ -0,0 +1,185 @@
+// afsm::io::write_queue against a loopback connection: batching, the high and
+// low watermarks, messages dropped after a sender accepted them and write
+// errors.
+
+// ours
+#include <check.hpp>
+
+#include <afsm/state.hpp>
+#include <afsm/io/events.hpp>
+#include <afsm/io/write_queue.hpp>
+
+// thirdparty
+#include <asio.hpp>
+
+// std
+#include <chrono>
+#include <optional>
+#include <string>
+#include <thread>
+#include <variant>
+
+struct done {};
+
+class writer : public afsm::state<done, afsm::io::send_backpressure, afsm::io::send_failed> {
+public:
+    writer(asio::io_service& io, asio::ip::tcp::socket& sock, afsm::io::watermarks wm) :
+        state(io),
+        out(*this, sock, wm)
+    {}
+
+    virtual void on_enter() override {}
+
+    virtual void cancel() override {}
+
+    afsm::io::write_queue<writer> out;
+};
+
+// without send_backpressure, the queue only blocks at the high watermark
+class plain_writer : public afsm::state<done, afsm::io::send_failed> {
+public:
+    plain_writer(asio::io_service& io, asio::ip::tcp::socket& sock, afsm::io::watermarks wm) :
+        state(io),
+        out(*this, sock, wm)
+    {}
+
+    virtual void on_enter() override {}
+
+    virtual void cancel() override {}
+
+    afsm::io::write_queue<plain_writer> out;
+};
+
+struct connection {
+    connection(asio::io_service& io) : local(io), peer(io) {
+        asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+        peer.connect(acceptor.local_endpoint());
+        acceptor.accept(local);
+    }
+
+    std::string read(std::size_t n) {
+        std::string data(n, '\0');
+        asio::read(peer, asio::buffer(data));
+        return data;
+    }
+
+    asio::ip::tcp::socket local;
+    asio::ip::tcp::socket peer;
+};
+
+// everything sent while a write is in flight goes out with the next one, in order
+static void batches_in_order() {
+    asio::io_service io;
+    connection c(io);
+    writer w(io, c.local, {});
+    w.async_wait([](const writer::result&) { CHECK(false); });
+
+    std::string expected;
+    for (int i = 0; i < 1000; ++i) {
+        auto msg = std::to_string(i) + "\n";
+        expected += msg;
+        CHECK(w.out.send(msg));
+    }
+    auto sender = w.out.get_sender();
+    std::thread t([&] {
+        for (int i = 0; i < 1000; ++i) {
+            CHECK(sender.send("x\n"));
+        }
+    });
+    t.join();
+    for (int i = 0; i < 1000; ++i) {
+        expected += "x\n";
+    }
+
+    io.run_for(std::chrono::milliseconds(100));
+    CHECK(c.read(expected.size()) == expected);
+    CHECK(w.out.queued() == 0);
+    CHECK(sender.dropped() == 0);
+}
+
+// the message reaching the high watermark is refused and completes the
+// owner, what comes next is refused too
+static void completes_on_backpressure() {
+    asio::io_service io;
+    connection c(io);
+    writer w(io, c.local, {16, 64});
+    std::optional<writer::result> res;
+    w.async_wait([&](const writer::result& r) { res = r; });
+
+    // completing outside of a tracked operation would not deliver the result
+    w.track([&] {
+        CHECK(w.out.send(std::string(10, 'a')));
+        CHECK(!w.out.send(std::string(100, 'b')));
+        CHECK(!w.out.send("c"));
+        CHECK(!w.out.get_sender().send("d"));
+    })();
+    io.run();
+    CHECK(res && std::holds_alternative<afsm::io::send_backpressure>(*res));
+    CHECK(std::get<afsm::io::send_backpressure>(*res).queued == 110);
+    CHECK(c.read(10) == std::string(10, 'a'));
+}
+
+// without send_backpressure the message is written, the queue accepts
+// messages again once it drained to the low watermark
+static void blocks_until_low_watermark() {
+    asio::io_service io;
+    connection c(io);
+    plain_writer w(io, c.local, {16, 64});
+    w.async_wait([](const plain_writer::result&) { CHECK(false); });
+
+    auto sender = w.out.get_sender();
+    CHECK(w.out.send(std::string(100, 'a')));
+    CHECK(!w.out.writable() && !sender.writable());
+    CHECK(!w.out.send("b"));
+    io.run_for(std::chrono::milliseconds(100));
+    CHECK(c.read(100) == std::string(100, 'a'));
+    CHECK(w.out.writable() && sender.writable());
+    CHECK(w.out.send("c\n"));
+    io.run_for(std::chrono::milliseconds(100));
+    CHECK(c.read(2) == "c\n");
+}
+
+// a sender accepted the messages, the queue blocked before they reached it
+static void counts_dropped() {
+    asio::io_service io;
+    connection c(io);
+    writer w(io, c.local, {16, 64});
+    w.async_wait([](const writer::result&) {});
+
+    auto sender = w.out.get_sender();
+    CHECK(sender.send("a"));
+    CHECK(sender.send("b"));
+    w.track([&] {
+        CHECK(!w.out.send(std::string(100, 'c')));
+    })();
+    io.run();
+    CHECK(sender.dropped() == 2);
+    CHECK(w.out.dropped() == 2);
+}
+
+// a failed write completes the owner with its error
+static void completes_on_write_error() {
+    asio::io_service io;
+    connection c(io);
+    writer w(io, c.local, {});
+    std::optional<writer::result> res;
+    w.async_wait([&](const writer::result& r) { res = r; });
+
+    c.local.shutdown(asio::ip::tcp::socket::shutdown_send);
+    w.track([&] {
+        CHECK(w.out.send("lost\n"));
+    })();
+    io.run();
+    CHECK(res && std::holds_alternative<afsm::io::send_failed>(*res));
+    CHECK(std::error_code(std::get<afsm::io::send_failed>(*res)) == asio::error::broken_pipe);
+    CHECK(w.out.error());
+    CHECK(!w.out.writable());
+}
+
+int main() {
+    batches_in_order();
+    completes_on_backpressure();
+    blocks_until_low_watermark();
+    counts_dropped();
+    completes_on_write_error();
+}